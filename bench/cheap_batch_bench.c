@@ -0,0 +1,130 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+/*
+ * cheap_batch_bench - batched vs. individual allocation
+ *
+ * For several batch sizes, reports ns per object for:
+ *
+ *   malloc:    n separate calls to cheap_malloc()
+ *   batch:     one call to cheap_malloc_batch() with mixed sizes
+ *   malloc_n:  one call to cheap_malloc_n() with a fixed size
+ *
+ * The cheap is rewound between batches with cheap_reset(), and the
+ * allocated memory is never touched.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include "cursor_heap.h"
+#include "xrand.h"
+
+enum bench_mode {
+	BENCH_MALLOC,
+	BENCH_BATCH,
+	BENCH_MALLOC_N,
+};
+
+static const char *mode_name[] = { "malloc", "batch", "malloc_n" };
+
+static double
+bench_run(struct cheap *h, enum bench_mode mode, const size_t *sizes, int n,
+	  long iters)
+{
+	void      *outv[n];
+	u_int64_t  start, stop;
+	u_int64_t  sum = 0;
+	long       iter;
+	int        i;
+
+	start = get_cycles();
+	for (iter = 0; iter < iters; ++iter) {
+		switch (mode) {
+		case BENCH_MALLOC:
+			for (i = 0; i < n; ++i)
+				outv[i] = cheap_malloc(h, sizes[i]);
+			break;
+
+		case BENCH_BATCH:
+			cheap_malloc_batch(h, sizes, n, outv);
+			break;
+
+		case BENCH_MALLOC_N:
+			cheap_malloc_n(h, sizes[0], n, outv);
+			break;
+		}
+
+		sum += (u_int64_t)outv[n - 1];
+
+		/* Rewind once the cheap is mostly used */
+		if (cheap_avail(h) < (64u << 10))
+			cheap_reset(h, 0);
+	}
+	stop = get_cycles();
+
+	cheap_reset(h, 0);
+
+	if (!sum)
+		printf("unexpected NULL allocation\n");
+
+	return (double)(stop - start) / ((double)iters * n);
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-i iterations] [-a alignment]\n", prog);
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	static const int nv[] = { 4, 16, 64, 256 };
+	size_t           sizes[256];
+	struct cheap    *h;
+	struct xrand     xr;
+	long             iters = 1000000;
+	int              alignment = 8;
+	size_t           i;
+	int              j, c;
+
+	while ((c = getopt(argc, argv, "i:a:")) != -1) {
+		switch (c) {
+		case 'i':
+			iters = atol(optarg);
+			break;
+		case 'a':
+			alignment = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (iters < 1)
+		usage(argv[0]);
+
+	xrand_init(&xr, 42);
+	for (i = 0; i < 256; ++i)
+		sizes[i] = xrand_range64(&xr, 16, 256);
+
+	h = cheap_create(alignment, 64u << 20);
+	if (!h) {
+		fprintf(stderr, "cheap_create failed\n");
+		return 1;
+	}
+
+	printf("%8s %10s %12s\n", "n", "mode", "ns/object");
+
+	for (i = 0; i < sizeof(nv) / sizeof(nv[0]); ++i) {
+		for (j = BENCH_MALLOC; j <= BENCH_MALLOC_N; ++j)
+			printf("%8d %10s %12.2f\n", nv[i], mode_name[j],
+			       bench_run(h, j, sizes, nv[i], iters / nv[i]));
+	}
+
+	cheap_destroy(h);
+
+	return 0;
+}
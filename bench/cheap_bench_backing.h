@@ -0,0 +1,102 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+/*
+ * The memory backings compared by the latency and bandwidth benchmarks
+ * (cheap_chase_bench, cheap_stream_bench):
+ *
+ *   anon:     the default MAP_SHARED | MAP_ANONYMOUS cheap
+ *   private:  CHEAP_F_PRIVATE
+ *   thp:      CHEAP_F_THP (needs THP enabled)
+ *   huge_2m:  CHEAP_F_HUGE_2M (needs free hugetlb pages)
+ *   numa:     cheap_create_numa() bound to one node
+ *   dax:      cheap_create_dax_range() over all of a DAX device or file
+ */
+
+#ifndef CHEAP_BENCH_BACKING_H
+#define CHEAP_BENCH_BACKING_H
+
+#include <errno.h>
+#include <string.h>
+
+#include "cursor_heap.h"
+
+enum bench_backing {
+	BENCH_ANON,
+	BENCH_PRIVATE,
+	BENCH_THP,
+	BENCH_HUGE_2M,
+	BENCH_NUMA,
+	BENCH_DAX,
+	BENCH_BACKING_MAX,
+};
+
+static const char *backing_name[] = {
+	"anon", "private", "thp", "huge_2m", "numa", "dax"
+};
+
+static const u_int32_t backing_flags[] = {
+	0, CHEAP_F_PRIVATE, CHEAP_F_THP, CHEAP_F_HUGE_2M, 0, 0
+};
+
+/* Return: the backing named @name, or BENCH_BACKING_MAX if none is */
+static inline int
+bench_backing_lookup(const char *name)
+{
+	int b;
+
+	for (b = 0; b < BENCH_BACKING_MAX; ++b)
+		if (!strcmp(name, backing_name[b]))
+			break;
+
+	return b;
+}
+
+/*
+ * bench_backing_create() - create a @size byte cheap with backing @b
+ *
+ * Huge pages quietly fall back to base pages when the kernel has none to
+ * give, and a result measured on those would be mislabeled, so that is
+ * a failure here.  @node is for BENCH_NUMA, @daxpath for BENCH_DAX (which
+ * maps all of it, regardless of @size).
+ *
+ * Return: the cheap, or NULL with errno set if @b is unavailable.
+ */
+static inline struct cheap *
+bench_backing_create(enum bench_backing b, int alignment, size_t size,
+		     int node, const char *daxpath)
+{
+	struct cheap_numa_policy policy = { 0 };
+	u_int32_t flags = backing_flags[b];
+	struct cheap *h;
+
+	switch (b) {
+	case BENCH_NUMA:
+		policy.mode = CHEAP_NUMA_BIND;
+		policy.nodemask = 1ull << node;
+		return cheap_create_numa(alignment, size, &policy);
+	case BENCH_DAX:
+		if (!daxpath) {
+			errno = ENOENT;
+			return NULL;
+		}
+		return cheap_create_dax_range(daxpath, 0, 0, alignment);
+	default:
+		break;
+	}
+
+	h = cheap_create_flags(alignment, size, flags);
+	if (!h)
+		return NULL;
+
+	if ((h->flags & flags) != flags ||
+	    ((flags & (CHEAP_F_THP | CHEAP_F_HUGE_2M)) &&
+	     cheap_pagesize(h) <= PAGE_SIZE)) {
+		cheap_destroy(h);
+		errno = (flags & CHEAP_F_THP) ? EOPNOTSUPP : ENOMEM;
+		return NULL;
+	}
+
+	return h;
+}
+
+#endif
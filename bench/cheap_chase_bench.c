@@ -0,0 +1,201 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+/*
+ * cheap_chase_bench - pointer-chase (load-to-use) latency, by backing
+ *
+ * In the style of multichase: carves a -w byte working set out of a cheap
+ * into -s byte elements, links them into a single cycle in random order,
+ * and reports the average nsec per dependent load while chasing -n links
+ * around it.  Each load depends on the previous one, so neither the
+ * hardware prefetchers nor out-of-order execution can hide the latency;
+ * with a working set much larger than the last level cache (and TLB
+ * reach) this is the memory's load-to-use latency.
+ *
+ * Backings (see cheap_bench_backing.h): anon, private, thp, huge_2m,
+ * numa (bound to node -N) and dax (-D <path>).  -m picks one; by default
+ * all of them are run, and any that can't be had (no huge pages, no -D)
+ * are reported as unavailable.  The cheap is populated and the chain
+ * built before timing starts.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "cursor_heap.h"
+#include "xrand.h"
+#include "cheap_bench_backing.h"
+
+struct bench_opts {
+	size_t      wss;        /* working set size */
+	size_t      stride;     /* bytes per chain element */
+	long        loads;
+	int         node;
+	const char *daxpath;
+};
+
+static void * volatile bench_sink;
+
+/* Link the @n elements at @base into one cycle, in random order */
+static void **
+bench_chain(char *base, size_t n, size_t stride)
+{
+	struct xrand xr;
+	size_t      *perm;
+	size_t       i, j, t;
+	void       **head;
+
+	perm = malloc(n * sizeof(*perm));
+	if (!perm) {
+		fprintf(stderr, "no memory for %zu element chain\n", n);
+		exit(1);
+	}
+
+	for (i = 0; i < n; ++i)
+		perm[i] = i;
+
+	xrand_init(&xr, 42);
+	for (i = n - 1; i > 0; --i) {
+		j = xrand_range64(&xr, 0, i + 1);
+		t = perm[i];
+		perm[i] = perm[j];
+		perm[j] = t;
+	}
+
+	for (i = 0; i < n; ++i)
+		*(void **)(base + perm[i] * stride) =
+			base + perm[(i + 1) % n] * stride;
+
+	head = (void **)(base + perm[0] * stride);
+	free(perm);
+
+	return head;
+}
+
+/* Follow @loads links from @p (in multiples of 16) */
+static __attribute__((noinline)) void *
+bench_chase(void **p, long loads)
+{
+	for (; loads > 0; loads -= 16) {
+		p = *p; p = *p; p = *p; p = *p;
+		p = *p; p = *p; p = *p; p = *p;
+		p = *p; p = *p; p = *p; p = *p;
+		p = *p; p = *p; p = *p; p = *p;
+	}
+
+	return p;
+}
+
+/* Return: nsec per load, or a negative value if @b is unavailable */
+static double
+bench_run(enum bench_backing b, const struct bench_opts *opts)
+{
+	struct cheap *h;
+	u_int64_t     start, ns;
+	size_t        n;
+	void        **p;
+	char         *base;
+
+	h = bench_backing_create(b, 64, opts->wss, opts->node, opts->daxpath);
+	if (!h)
+		return -1;
+
+	base = cheap_malloc(h, opts->wss);
+	if (!base || cheap_populate(h, opts->wss, 0)) {
+		cheap_destroy(h);
+		errno = ENOSPC;
+		return -1;
+	}
+
+	n = opts->wss / opts->stride;
+	p = bench_chain(base, n, opts->stride);
+
+	/* One lap to warm the caches and TLB to their steady state */
+	p = bench_chase(p, n);
+
+	start = get_cycles();
+	p = bench_chase(p, opts->loads);
+	ns = get_cycles() - start;
+
+	bench_sink = p;
+	cheap_destroy(h);
+
+	return (double)ns / opts->loads;
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-w wss] [-s stride] [-n loads] [-m backing] "
+		"[-N node] [-D daxpath]\n",
+		prog);
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct bench_opts opts = {
+		.wss = 256ul << 20,
+		.stride = 256,
+		.loads = 20000000,
+	};
+	int    first = 0, last = BENCH_BACKING_MAX - 1;
+	int    b;
+	double ns;
+	int    c;
+
+	while ((c = getopt(argc, argv, "w:s:n:m:N:D:")) != -1) {
+		switch (c) {
+		case 'w':
+			opts.wss = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			opts.stride = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			opts.loads = atol(optarg);
+			break;
+		case 'm':
+			b = bench_backing_lookup(optarg);
+			if (b == BENCH_BACKING_MAX)
+				usage(argv[0]);
+			first = last = b;
+			break;
+		case 'N':
+			opts.node = atoi(optarg);
+			break;
+		case 'D':
+			opts.daxpath = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (opts.stride < sizeof(void *) || opts.stride % sizeof(void *) ||
+	    opts.wss / opts.stride < 2 || opts.loads < 1 ||
+	    opts.node < 0 || opts.node > 63)
+		usage(argv[0]);
+
+	opts.loads = (opts.loads + 15) & ~15l;
+
+	printf("wss %zu bytes, stride %zu, %ld loads\n", opts.wss, opts.stride,
+	       opts.loads);
+	printf("%10s %12s\n", "backing", "ns/load");
+
+	for (b = first; b <= last; ++b) {
+		ns = bench_run(b, &opts);
+		if (ns < 0)
+			printf("%10s %12s (%s)\n", backing_name[b],
+			       "unavailable", strerror(errno));
+		else
+			printf("%10s %12.2f\n", backing_name[b], ns);
+	}
+
+	return 0;
+}
@@ -0,0 +1,144 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+/*
+ * cheap_fault_bench - first-touch cost of shared vs. private cheaps
+ *
+ * Each cycle creates a fresh cheap and first-touches all of it, either:
+ *
+ *   fault:  one byte per base page (reported as nsec per page touched,
+ *           which for thp covers many pages per fault)
+ *   fill:   memset() of the whole cheap (reported as GB/s)
+ *
+ * for each of these mappings:
+ *
+ *   shared:   the default MAP_SHARED | MAP_ANONYMOUS (shmem)
+ *   private:  CHEAP_F_PRIVATE
+ *   thp:      CHEAP_F_THP (private, with MADV_HUGEPAGE)
+ *
+ * The cost of cheap_create() and cheap_destroy() is not included.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "cursor_heap.h"
+
+enum bench_mode {
+	BENCH_SHARED,
+	BENCH_PRIVATE,
+	BENCH_THP,
+};
+
+static const char *mode_name[] = { "shared", "private", "thp" };
+
+static const u_int32_t mode_flags[] = { 0, CHEAP_F_PRIVATE, CHEAP_F_THP };
+
+struct bench_result {
+	double fault_ns;
+	double fill_gbs;
+};
+
+static struct cheap *
+bench_create(enum bench_mode mode, size_t heapsz)
+{
+	struct cheap *h;
+
+	h = cheap_create_flags(8, heapsz, mode_flags[mode]);
+	if (!h) {
+		fprintf(stderr, "cheap_create_flags failed (%zu bytes)\n",
+			heapsz);
+		exit(1);
+	}
+
+	return h;
+}
+
+static void
+bench_run(enum bench_mode mode, size_t heapsz, long cycles,
+	  struct bench_result *res)
+{
+	u_int64_t faults = 0, fault_ns = 0, fill_ns = 0, filled = 0;
+	u_int64_t start;
+	struct cheap *h;
+	char *p;
+	long i;
+
+	for (i = 0; i < cycles; ++i) {
+		size_t off, used;
+
+		h = bench_create(mode, heapsz);
+		p = cheap_malloc(h, cheap_avail(h));
+		used = cheap_used(h);
+
+		start = get_cycles();
+		for (off = 0; off < used; off += PAGE_SIZE)
+			p[off] = 1;
+		fault_ns += get_cycles() - start;
+		faults += off / PAGE_SIZE;
+
+		cheap_destroy(h);
+
+		h = bench_create(mode, heapsz);
+		p = cheap_malloc(h, cheap_avail(h));
+		used = cheap_used(h);
+
+		/* The cheap may be larger than asked for (rounded up to the
+		 * page size), so count what was actually written.
+		 */
+		start = get_cycles();
+		memset(p, 1, used);
+		fill_ns += get_cycles() - start;
+		filled += used;
+
+		cheap_destroy(h);
+	}
+
+	res->fault_ns = (double)fault_ns / faults;
+	res->fill_gbs = (double)filled / fill_ns;
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "usage: %s [-H heapsize] [-c cycles]\n", prog);
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct bench_result res;
+	size_t heapsz = 256ul << 20;
+	long   cycles = 5;
+	int    mode;
+	int    c;
+
+	while ((c = getopt(argc, argv, "H:c:")) != -1) {
+		switch (c) {
+		case 'H':
+			heapsz = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			cycles = atol(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (heapsz < PAGE_SIZE || cycles < 1)
+		usage(argv[0]);
+
+	printf("heap %zu bytes, %ld cycles\n", heapsz, cycles);
+	printf("%10s %16s %16s\n", "mode", "nsec/page", "fill GB/s");
+
+	for (mode = BENCH_SHARED; mode <= BENCH_THP; ++mode) {
+		bench_run(mode, heapsz, cycles, &res);
+		printf("%10s %16.1f %16.2f\n", mode_name[mode],
+		       res.fault_ns, res.fill_gbs);
+	}
+
+	return 0;
+}
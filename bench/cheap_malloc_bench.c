@@ -0,0 +1,121 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+/*
+ * cheap_malloc_bench - ns per cheap_malloc(), inline vs. out of line
+ *
+ * Fills a cheap with -s byte allocations (resetting it when full) until
+ * -n allocations have been made, via:
+ *
+ *   out_of_line:  cheap_malloc_slow(), i.e. a call into the library for
+ *                 every allocation (which is what cheap_malloc() was)
+ *   inline:       cheap_malloc(), whose fast path is in cursor_heap.h
+ *
+ * for a single threaded and a CHEAP_F_MT cheap (which always takes the
+ * out of line path).  cheap_malloc_bench_lto is the same program built,
+ * along with the library, with link-time optimization.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include "cursor_heap.h"
+
+enum bench_mode {
+	BENCH_OUT_OF_LINE,
+	BENCH_INLINE,
+};
+
+static const char *mode_name[] = { "out_of_line", "inline" };
+
+static volatile u_int64_t bench_sink;
+
+static double
+bench_run(enum bench_mode mode, struct cheap *h, size_t size, long n)
+{
+	u_int64_t start, sum = 0;
+	void     *p;
+	long      i;
+
+	cheap_reset(h, 0);
+
+	start = get_cycles();
+	for (i = 0; i < n; ++i) {
+		if (mode == BENCH_INLINE)
+			p = cheap_malloc(h, size);
+		else
+			p = cheap_malloc_slow(h, size);
+
+		if (__builtin_expect(!p, 0)) {
+			cheap_reset(h, 0);
+			p = cheap_malloc(h, size);
+		}
+		sum += (u_int64_t)p;
+	}
+	bench_sink = sum;
+
+	return (double)(get_cycles() - start) / n;
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-s allocsize] [-n allocations] [-H heapsize]\n",
+		prog);
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	size_t heapsz = 64ul << 20;
+	size_t size = 32;
+	long   n = 100000000;
+	struct cheap *h;
+	double ns;
+	int    mt, mode;
+	int    c;
+
+	while ((c = getopt(argc, argv, "s:n:H:")) != -1) {
+		switch (c) {
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			n = atol(optarg);
+			break;
+		case 'H':
+			heapsz = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (size < 1 || n < 1 || heapsz < size)
+		usage(argv[0]);
+
+	printf("%6s %12s %10s %12s\n", "cheap", "mode", "size", "ns/alloc");
+
+	for (mt = 0; mt < 2; ++mt) {
+		h = cheap_create_flags(16, heapsz, mt ? CHEAP_F_MT : 0);
+		if (!h) {
+			fprintf(stderr, "cheap_create_flags failed\n");
+			exit(1);
+		}
+
+		/* Fault the cheap in first */
+		bench_run(BENCH_INLINE, h, size, heapsz / size);
+
+		for (mode = BENCH_OUT_OF_LINE; mode <= BENCH_INLINE; ++mode) {
+			ns = bench_run(mode, h, size, n);
+			printf("%6s %12s %10zu %12.2f\n", mt ? "mt" : "st",
+			       mode_name[mode], size, ns);
+		}
+
+		cheap_destroy(h);
+	}
+
+	return 0;
+}
@@ -0,0 +1,186 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+/*
+ * cheap_mt_bench - allocation scaling of a shared cursor heap
+ *
+ * Measures aggregate allocations/sec from 1 to N threads for:
+ *
+ *   st:        a plain cheap, one thread, no locking (the baseline)
+ *   st+mutex:  a plain cheap shared by all threads under a mutex
+ *   mt:        an MT cheap (cheap_create_mt()) shared by all threads
+ *   mt+tcache: an MT cheap with per-thread chunks (cheap_tcache_enable())
+ *
+ * The allocated memory is never touched, so this measures the allocator
+ * and the cache line holding the cursor, not page faults.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#include "cursor_heap.h"
+
+enum bench_mode {
+	BENCH_ST,
+	BENCH_ST_MUTEX,
+	BENCH_MT,
+	BENCH_MT_TCACHE,
+};
+
+static const char *mode_name[] = { "st", "st+mutex", "mt", "mt+tcache" };
+
+struct bench {
+	struct cheap      *h;
+	enum bench_mode    mode;
+	pthread_mutex_t    lock;
+	pthread_barrier_t  barrier;
+	long               nallocs;
+	size_t             size;
+};
+
+static void *
+bench_worker(void *rock)
+{
+	struct bench *b = rock;
+	u_int64_t     sum = 0;
+	long          i;
+
+	pthread_barrier_wait(&b->barrier);
+
+	switch (b->mode) {
+	case BENCH_ST_MUTEX:
+		for (i = 0; i < b->nallocs; ++i) {
+			pthread_mutex_lock(&b->lock);
+			sum += (u_int64_t)cheap_malloc(b->h, b->size);
+			pthread_mutex_unlock(&b->lock);
+		}
+		break;
+
+	default:
+		for (i = 0; i < b->nallocs; ++i)
+			sum += (u_int64_t)cheap_malloc(b->h, b->size);
+		break;
+	}
+
+	pthread_barrier_wait(&b->barrier);
+
+	return (void *)sum;
+}
+
+static double
+bench_run(enum bench_mode mode, int nthreads, long nallocs, size_t size,
+	  int alignment)
+{
+	pthread_t    *tidv;
+	struct bench  b;
+	size_t        total;
+	u_int64_t     start, stop;
+	int           i;
+
+	total = ALIGN(size, alignment) * nallocs * nthreads;
+
+	b.mode = mode;
+	b.nallocs = nallocs;
+	b.size = size;
+	if (mode >= BENCH_MT) {
+		/* Leave room for every thread to strand part of a chunk */
+		total += (size_t)nthreads * CHEAP_TCACHE_CHUNKSZ;
+		b.h = cheap_create_mt(alignment, total);
+		if (b.h && mode == BENCH_MT_TCACHE)
+			cheap_tcache_enable(b.h, 0);
+	} else {
+		b.h = cheap_create(alignment, total);
+	}
+	if (!b.h) {
+		fprintf(stderr, "cheap_create failed (%zu bytes)\n", total);
+		exit(1);
+	}
+
+	pthread_mutex_init(&b.lock, NULL);
+	pthread_barrier_init(&b.barrier, NULL, nthreads + 1);
+
+	tidv = calloc(nthreads, sizeof(*tidv));
+	for (i = 0; i < nthreads; ++i)
+		pthread_create(&tidv[i], NULL, bench_worker, &b);
+
+	pthread_barrier_wait(&b.barrier);
+	start = get_cycles();
+	pthread_barrier_wait(&b.barrier);
+	stop = get_cycles();
+
+	for (i = 0; i < nthreads; ++i)
+		pthread_join(tidv[i], NULL);
+
+	free(tidv);
+	pthread_barrier_destroy(&b.barrier);
+	pthread_mutex_destroy(&b.lock);
+	cheap_destroy(b.h);
+
+	return (double)nallocs * nthreads * 1e9 / (stop - start);
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-t maxthreads] [-n allocs/thread] [-s size] [-a alignment]\n",
+		prog);
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	long   nallocs = 4 * 1000 * 1000;
+	int    maxthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t size = 48;
+	int    alignment = 8;
+	int    nthreads;
+	int    c;
+
+	while ((c = getopt(argc, argv, "t:n:s:a:")) != -1) {
+		switch (c) {
+		case 't':
+			maxthreads = atoi(optarg);
+			break;
+		case 'n':
+			nallocs = atol(optarg);
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 'a':
+			alignment = atoi(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (maxthreads < 1 || nallocs < 1 || size < 1)
+		usage(argv[0]);
+
+	printf("%8s %10s %16s\n", "threads", "mode", "allocs/sec");
+
+	printf("%8d %10s %16.0f\n", 1, mode_name[BENCH_ST],
+	       bench_run(BENCH_ST, 1, nallocs, size, alignment));
+
+	for (nthreads = 1;; nthreads *= 2) {
+		enum bench_mode mode;
+
+		/* Always finish with exactly maxthreads */
+		if (nthreads > maxthreads)
+			nthreads = maxthreads;
+
+		for (mode = BENCH_ST_MUTEX; mode <= BENCH_MT_TCACHE; ++mode)
+			printf("%8d %10s %16.0f\n", nthreads, mode_name[mode],
+			       bench_run(mode, nthreads, nallocs, size, alignment));
+
+		if (nthreads == maxthreads)
+			break;
+	}
+
+	return 0;
+}
@@ -0,0 +1,194 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+/*
+ * cheap_persist_bench - cost of making allocations durable, by strategy
+ *
+ * For each allocation size from -m to -M (by factors of 4), allocates
+ * from a cheap backed by -d <path> (a devdax device, a pmem device, or a
+ * file; a temporary file by default), fills each allocation and makes it
+ * durable with:
+ *
+ *   msync:        msync() of the pages the allocation touches
+ *   msync_all:    msync() of the whole mapping
+ *   clwb, clflushopt, clflush:
+ *                 cheap_flush() with that instruction (skipped if the
+ *                 CPU lacks it); only durable on a synchronous (devdax
+ *                 or MAP_SYNC fs-dax) mapping, but the cost is the same
+ *   cheap_persist: cheap_persist(), i.e. whichever of the above is
+ *                 correct for the mapping
+ *
+ * and reports ns per allocation and the fill+persist rate.
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/mman.h>
+
+#include "cursor_heap.h"
+
+enum bench_mode {
+	BENCH_MSYNC,
+	BENCH_MSYNC_ALL,
+	BENCH_CLWB,
+	BENCH_CLFLUSHOPT,
+	BENCH_CLFLUSH,
+	BENCH_PERSIST,
+};
+
+static const char *mode_name[] = {
+	"msync", "msync_all", "clwb", "clflushopt", "clflush", "cheap_persist"
+};
+
+static void
+bench_persist(enum bench_mode mode, struct cheap *h, char *p, size_t size)
+{
+	uintptr_t start = (uintptr_t)p & PAGE_MASK;
+
+	switch (mode) {
+	case BENCH_MSYNC:
+		msync((void *)start, (uintptr_t)p + size - start, MS_SYNC);
+		break;
+	case BENCH_MSYNC_ALL:
+		msync(h->mem, h->size, MS_SYNC);
+		break;
+	case BENCH_CLWB:
+	case BENCH_CLFLUSHOPT:
+	case BENCH_CLFLUSH:
+		cheap_flush(p, size);
+		break;
+	case BENCH_PERSIST:
+		cheap_persist(h, p, size);
+		break;
+	}
+}
+
+/* Returns ns per allocation, or 0 if @mode isn't supported */
+static double
+bench_run(enum bench_mode mode, struct cheap *h, size_t size, long iters)
+{
+	u_int64_t start, ns;
+	char     *p;
+	long      i;
+
+	if (mode >= BENCH_CLWB && mode <= BENCH_CLFLUSH &&
+	    cheap_flush_select(mode_name[mode]))
+		return 0;
+
+	cheap_reset(h, 0);
+
+	start = get_cycles();
+	for (i = 0; i < iters; ++i) {
+		p = cheap_malloc(h, size);
+		if (!p) {
+			cheap_reset(h, 0);
+			p = cheap_malloc(h, size);
+		}
+		memset(p, i, size);
+		bench_persist(mode, h, p, size);
+	}
+	ns = get_cycles() - start;
+
+	cheap_flush_select(NULL);
+
+	return (double)ns / iters;
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-d path] [-H heapsize] [-m minsize] [-M maxsize] [-b bytes/size]\n",
+		prog);
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	char   tmppath[] = "/tmp/cheap_persist_bench.XXXXXX";
+	const char *path = NULL;
+	size_t heapsz = 256ul << 20;
+	size_t minsz = 64, maxsz = 1ul << 20;
+	size_t total = 64ul << 20;
+	struct cheap *h;
+	size_t size;
+	double ns;
+	int    mode;
+	int    fd;
+	int    c;
+
+	while ((c = getopt(argc, argv, "d:H:m:M:b:")) != -1) {
+		switch (c) {
+		case 'd':
+			path = optarg;
+			break;
+		case 'H':
+			heapsz = strtoul(optarg, NULL, 0);
+			break;
+		case 'm':
+			minsz = strtoul(optarg, NULL, 0);
+			break;
+		case 'M':
+			maxsz = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			total = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (minsz < 1 || maxsz < minsz || total < 1 || heapsz < PAGE_SIZE)
+		usage(argv[0]);
+
+	if (!path) {
+		fd = mkstemp(tmppath);
+		if (fd < 0 || ftruncate(fd, PAGE_ALIGN(heapsz))) {
+			perror(tmppath);
+			exit(1);
+		}
+		close(fd);
+		path = tmppath;
+	}
+
+	h = cheap_create_dax_range(path, 0, 0, 64);
+	if (!h) {
+		perror(path);
+		exit(1);
+	}
+
+	if (maxsz > h->size)
+		maxsz = h->size;
+
+	printf("%s: %s mapping, best flush %s\n", path,
+	       h->mapsync ? "synchronous" : "page cache", cheap_flush_isa());
+	printf("%12s %14s %12s %12s\n", "size", "mode", "ns/alloc", "GB/s");
+
+	for (size = minsz; size <= maxsz; size *= 4) {
+		long iters = total / size ?: 1;
+
+		for (mode = BENCH_MSYNC; mode <= BENCH_PERSIST; ++mode) {
+			/* Flushing a whole heap per allocation gets silly */
+			ns = bench_run(mode, h, size,
+				       mode == BENCH_MSYNC_ALL && iters > 1000 ?
+				       1000 : iters);
+			if (!ns)
+				continue;
+
+			printf("%12zu %14s %12.0f %12.2f\n",
+			       size, mode_name[mode], ns, size / ns);
+		}
+	}
+
+	cheap_destroy(h);
+
+	if (path == tmppath)
+		unlink(tmppath);
+
+	return 0;
+}
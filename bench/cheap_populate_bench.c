@@ -0,0 +1,154 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+/*
+ * cheap_populate_bench - cost and benefit of pre-faulting a cheap
+ *
+ * For each mode, creates a cheap and reports:
+ *
+ *   startup:  time to create (and populate) the cheap
+ *   first:    throughput of a first pass of allocate-and-touch over
+ *             the whole cheap (this is where a lazy cheap faults)
+ *   steady:   throughput of a second pass, after cheap_reset()
+ *
+ * Modes:
+ *
+ *   lazy:        no populate; pages fault in on first touch
+ *   prefault:    cheap_prefault_start() with the default window
+ *   populate/N:  cheap_populate() with N threads, for N = 1, 2, 4, ...
+ *                up to -t maxthreads
+ *
+ * Pass -d <path> to use a DAX device via cheap_create_dax() instead of
+ * (private) anonymous memory.  Note that both passes write to it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "cursor_heap.h"
+
+struct bench_result {
+	double startup_ms;
+	double first_gbs;
+	double steady_gbs;
+};
+
+/* Allocate the whole cheap in @size byte pieces and write to each */
+static u_int64_t
+bench_pass(struct cheap *h, size_t size)
+{
+	u_int64_t start = get_cycles();
+	char     *p;
+
+	while ((p = cheap_malloc(h, size)))
+		memset(p, 1, size);
+
+	return get_cycles() - start;
+}
+
+static void
+bench_run(const char *daxpath, size_t heapsz, size_t size, int nthreads,
+	  struct bench_result *res)
+{
+	struct cheap *h;
+	u_int64_t     start, ns;
+	size_t        used;
+
+	start = get_cycles();
+	if (daxpath)
+		h = cheap_create_dax(daxpath, 8);
+	else
+		h = cheap_create_flags(8, heapsz, CHEAP_F_PRIVATE);
+	if (!h) {
+		fprintf(stderr, "cheap create failed\n");
+		exit(1);
+	}
+	if (nthreads > 0 && cheap_populate(h, 0, nthreads)) {
+		fprintf(stderr, "cheap_populate failed\n");
+		exit(1);
+	}
+	if (nthreads < 0 && cheap_prefault_start(h, 0, 0)) {
+		fprintf(stderr, "cheap_prefault_start failed\n");
+		exit(1);
+	}
+	res->startup_ms = (get_cycles() - start) / 1e6;
+
+	ns = bench_pass(h, size);
+	used = cheap_used(h);
+	res->first_gbs = (double)used / ns;
+
+	cheap_reset(h, 0);
+	ns = bench_pass(h, size);
+	res->steady_gbs = (double)cheap_used(h) / ns;
+
+	cheap_destroy(h);
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-H heapsize] [-s allocsize] [-t maxthreads] [-d daxpath]\n",
+		prog);
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct bench_result res;
+	const char *daxpath = NULL;
+	size_t heapsz = 1ul << 30;
+	size_t size = 4096;
+	int    maxthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	int    nthreads;
+	char   name[32];
+	int    c;
+
+	while ((c = getopt(argc, argv, "H:s:t:d:")) != -1) {
+		switch (c) {
+		case 'H':
+			heapsz = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			maxthreads = atoi(optarg);
+			break;
+		case 'd':
+			daxpath = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (heapsz < PAGE_SIZE || size < 1 || maxthreads < 1)
+		usage(argv[0]);
+
+	printf("%14s %12s %12s %12s\n",
+	       "mode", "startup ms", "first GB/s", "steady GB/s");
+
+	/* -1 is prefault, 0 is lazy */
+	for (nthreads = -1;; nthreads = nthreads > 0 ? nthreads * 2 : nthreads + 1) {
+		/* Always finish with exactly maxthreads */
+		if (nthreads > maxthreads)
+			nthreads = maxthreads;
+
+		if (nthreads > 0)
+			snprintf(name, sizeof(name), "populate/%d", nthreads);
+		else
+			snprintf(name, sizeof(name), nthreads ? "prefault" : "lazy");
+
+		bench_run(daxpath, heapsz, size, nthreads, &res);
+		printf("%14s %12.1f %12.2f %12.2f\n", name,
+		       res.startup_ms, res.first_gbs, res.steady_gbs);
+
+		if (nthreads == maxthreads)
+			break;
+	}
+
+	return 0;
+}
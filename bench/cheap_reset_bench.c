@@ -0,0 +1,152 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+/*
+ * cheap_reset_bench - cost of reusing a cheap vs. re-creating it
+ *
+ * Each cycle fills a cheap with allocations, writing to every page
+ * (as a sync interval's worth of tree nodes would), and then either:
+ *
+ *   reset:           cheap_reset(h, 0), keeping the pages resident
+ *   reset+trim:      cheap_reset(h, 0) and cheap_trim(h, rss)
+ *   destroy+create:  cheap_destroy(h) followed by cheap_create()
+ *
+ * Reported times are per cycle, and include the fill (which is where
+ * destroy+create pays for its page faults).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "cursor_heap.h"
+
+enum bench_mode {
+	BENCH_RESET,
+	BENCH_RESET_TRIM,
+	BENCH_DESTROY,
+};
+
+static const char *mode_name[] = { "reset", "reset+trim", "destroy+create" };
+
+static u_int64_t
+bench_fill(struct cheap *h, size_t fill, size_t size)
+{
+	u_int64_t sum = 0;
+	size_t    off;
+	char     *p;
+
+	for (off = 0; off + size <= fill; off += size) {
+		p = cheap_malloc(h, size);
+		if (!p) {
+			fprintf(stderr, "cheap_malloc failed at %zu\n", off);
+			exit(1);
+		}
+
+		/* Touch every page the allocation spans */
+		for (sum += (u_int64_t)p; p < (char *)h->cursorp; p += PAGE_SIZE)
+			*p = 1;
+	}
+
+	return sum;
+}
+
+static double
+bench_run(enum bench_mode mode, size_t heapsz, size_t fill, size_t size,
+	  long cycles)
+{
+	struct cheap *h;
+	u_int64_t     start, stop;
+	long          i;
+
+	h = cheap_create(8, heapsz);
+	if (!h) {
+		fprintf(stderr, "cheap_create failed (%zu bytes)\n", heapsz);
+		exit(1);
+	}
+
+	/* Warm up so every mode starts with a populated cheap */
+	bench_fill(h, fill, size);
+	cheap_reset(h, 0);
+
+	start = get_cycles();
+	for (i = 0; i < cycles; ++i) {
+		bench_fill(h, fill, size);
+
+		switch (mode) {
+		case BENCH_RESET:
+			cheap_reset(h, 0);
+			break;
+
+		case BENCH_RESET_TRIM:
+			cheap_reset(h, 0);
+			cheap_trim(h, fill / 2);
+			break;
+
+		case BENCH_DESTROY:
+			cheap_destroy(h);
+			h = cheap_create(8, heapsz);
+			break;
+		}
+	}
+	stop = get_cycles();
+
+	cheap_destroy(h);
+
+	return (double)(stop - start) / cycles;
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-H heapsize] [-f fillsize] [-s allocsize] [-c cycles]\n",
+		prog);
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	size_t heapsz = 256ul << 20;
+	size_t fill = 0;
+	size_t size = 256;
+	long   cycles = 20;
+	int    mode;
+	int    c;
+
+	while ((c = getopt(argc, argv, "H:f:s:c:")) != -1) {
+		switch (c) {
+		case 'H':
+			heapsz = strtoul(optarg, NULL, 0);
+			break;
+		case 'f':
+			fill = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			size = strtoul(optarg, NULL, 0);
+			break;
+		case 'c':
+			cycles = atol(optarg);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (!fill)
+		fill = heapsz;
+
+	if (fill > heapsz || size < 1 || cycles < 1)
+		usage(argv[0]);
+
+	printf("heap %zu bytes, fill %zu bytes in %zu byte allocations\n",
+	       heapsz, fill, size);
+	printf("%16s %16s\n", "mode", "usec/cycle");
+
+	for (mode = BENCH_RESET; mode <= BENCH_DESTROY; ++mode)
+		printf("%16s %16.1f\n", mode_name[mode],
+		       bench_run(mode, heapsz, fill, size, cycles) / 1000.0);
+
+	return 0;
+}
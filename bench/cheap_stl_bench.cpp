@@ -0,0 +1,212 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+/*
+ * cheap_stl_bench - STL container builds, by allocator
+ *
+ * Builds a std::vector (by push_back, without reserve), a std::map and a
+ * std::unordered_map of -n elements, -i times each, with:
+ *
+ *   std:            the default allocator (i.e. malloc)
+ *   cheap:          cheap_allocator<T>
+ *   pmr_monotonic:  std::pmr::monotonic_buffer_resource over new/delete
+ *   pmr_cheap:      cheap_resource
+ *
+ * and reports ns per element, including destroying the container (and
+ * resetting the cheap, or releasing the monotonic resource).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include <map>
+#include <unordered_map>
+#include <vector>
+
+#include "cursor_heap.hpp"
+
+enum bench_alloc {
+    BENCH_STD,
+    BENCH_CHEAP,
+#if CHEAP_HAVE_PMR
+    BENCH_PMR_MONOTONIC,
+    BENCH_PMR_CHEAP,
+#endif
+    BENCH_ALLOC_MAX,
+};
+
+static const char *alloc_name[] = { "std", "cheap", "pmr_monotonic", "pmr_cheap" };
+
+/* A cheap pseudo-random key sequence, so map inserts aren't in order */
+static inline u_int64_t
+bench_key(u_int64_t i)
+{
+    return (i * 0x9e3779b97f4a7c15ull) >> 16;
+}
+
+template <class Vector>
+static void
+bench_vector(Vector &v, long n)
+{
+    for (long i = 0; i < n; ++i)
+        v.push_back(i);
+}
+
+template <class Map>
+static void
+bench_map(Map &m, long n)
+{
+    for (long i = 0; i < n; ++i)
+        m.emplace(bench_key(i), i);
+}
+
+/* Build and destroy a container @iters times with allocator @alloc */
+template <template <class> class Container>
+static double
+bench_run(enum bench_alloc alloc, struct cheap *h, long n, long iters)
+{
+    u_int64_t start = get_cycles();
+
+    for (long it = 0; it < iters; ++it) {
+        switch (alloc) {
+        case BENCH_STD: {
+            typename Container<std::allocator<char>>::type c;
+
+            Container<std::allocator<char>>::build(c, n);
+            break;
+        }
+        case BENCH_CHEAP: {
+            {
+                typename Container<cheap_allocator<char>>::type c{
+                    cheap_allocator<char>(h)
+                };
+
+                Container<cheap_allocator<char>>::build(c, n);
+            }
+            cheap_reset(h, 0);
+            break;
+        }
+#if CHEAP_HAVE_PMR
+        case BENCH_PMR_MONOTONIC: {
+            std::pmr::monotonic_buffer_resource res;
+            typename Container<std::pmr::polymorphic_allocator<char>>::type c{ &res };
+
+            Container<std::pmr::polymorphic_allocator<char>>::build(c, n);
+            break;
+        }
+        case BENCH_PMR_CHEAP: {
+            {
+                cheap_resource res(h);
+                typename Container<std::pmr::polymorphic_allocator<char>>::type c{
+                    &res
+                };
+
+                Container<std::pmr::polymorphic_allocator<char>>::build(c, n);
+            }
+            cheap_reset(h, 0);
+            break;
+        }
+#endif
+        default:
+            break;
+        }
+    }
+
+    return (double)(get_cycles() - start) / (n * iters);
+}
+
+template <class A>
+using bench_rebind = typename std::allocator_traits<A>::template rebind_alloc<
+    std::pair<const u_int64_t, u_int64_t>>;
+
+template <class A>
+struct bench_vec {
+    using type = std::vector<u_int64_t,
+                             typename std::allocator_traits<A>::template rebind_alloc<u_int64_t>>;
+
+    static void build(type &c, long n) { bench_vector(c, n); }
+};
+
+template <class A>
+struct bench_tree {
+    using type = std::map<u_int64_t, u_int64_t, std::less<u_int64_t>, bench_rebind<A>>;
+
+    static void build(type &c, long n) { bench_map(c, n); }
+};
+
+template <class A>
+struct bench_hash {
+    using type = std::unordered_map<u_int64_t, u_int64_t, std::hash<u_int64_t>,
+                                    std::equal_to<u_int64_t>, bench_rebind<A>>;
+
+    static void build(type &c, long n) { bench_map(c, n); }
+};
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-n elements] [-i iterations] [-H heapsize]\n", prog);
+    exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+    struct cheap *h;
+    size_t heapsz = 1ul << 30;
+    long   n = 1000000, iters = 5;
+    double ns;
+    int    alloc;
+    int    c;
+
+    while ((c = getopt(argc, argv, "n:i:H:")) != -1) {
+        switch (c) {
+        case 'n':
+            n = atol(optarg);
+            break;
+        case 'i':
+            iters = atol(optarg);
+            break;
+        case 'H':
+            heapsz = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (n < 1 || iters < 1)
+        usage(argv[0]);
+
+    h = cheap_create(64, heapsz);
+    if (!h) {
+        fprintf(stderr, "cheap_create failed\n");
+        exit(1);
+    }
+
+    printf("%16s %16s %12s\n", "container", "allocator", "ns/elem");
+
+    try {
+        for (alloc = 0; alloc < BENCH_ALLOC_MAX; ++alloc) {
+            ns = bench_run<bench_vec>((enum bench_alloc)alloc, h, n, iters);
+            printf("%16s %16s %12.2f\n", "vector", alloc_name[alloc], ns);
+        }
+
+        for (alloc = 0; alloc < BENCH_ALLOC_MAX; ++alloc) {
+            ns = bench_run<bench_tree>((enum bench_alloc)alloc, h, n, iters);
+            printf("%16s %16s %12.2f\n", "map", alloc_name[alloc], ns);
+        }
+
+        for (alloc = 0; alloc < BENCH_ALLOC_MAX; ++alloc) {
+            ns = bench_run<bench_hash>((enum bench_alloc)alloc, h, n, iters);
+            printf("%16s %16s %12.2f\n", "unordered_map", alloc_name[alloc], ns);
+        }
+    } catch (const std::bad_alloc &) {
+        fprintf(stderr, "cheap full, try a larger -H\n");
+        exit(1);
+    }
+
+    cheap_destroy(h);
+
+    return 0;
+}
@@ -0,0 +1,370 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+/*
+ * cheap_stream_bench - STREAM memory bandwidth, by backing
+ *
+ * The four STREAM kernels over three -n element arrays of doubles:
+ *
+ *   copy:   c[i] = a[i]                  (16 bytes per element)
+ *   scale:  b[i] = s * c[i]              (16 bytes per element)
+ *   add:    c[i] = a[i] + b[i]           (24 bytes per element)
+ *   triad:  a[i] = b[i] + s * c[i]       (24 bytes per element)
+ *
+ * Each array comes from cheap_memalign() with alignment -A, and -o pads
+ * each array from the end of the previous one (to stagger them across
+ * cache sets and pages, like STREAM's OFFSET).  -t threads (default: one
+ * per CPU the process may run on) are each pinned to one of those CPUs
+ * and work on a fixed slice of every array; they also initialize their
+ * slices, so first-touch places pages as STREAM would.  Each kernel is
+ * run -i times and, as in STREAM, the best time is reported, in GB/s,
+ * not counting write-allocate traffic.  The results are checked against
+ * the expected values at the end.
+ *
+ * Backings (see cheap_bench_backing.h): anon, private, thp, huge_2m,
+ * numa (bound to node -N) and dax (-D <path>).  -m picks one; any that
+ * can't be had are reported as unavailable.
+ * For numa, pin the process to that node's CPUs (e.g. with taskset) to
+ * measure local bandwidth, or to another node's for remote bandwidth.
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#include "cursor_heap.h"
+#include "cheap_bench_backing.h"
+
+#define BENCH_SCALAR    3.0
+
+enum bench_kernel {
+	BENCH_COPY,
+	BENCH_SCALE,
+	BENCH_ADD,
+	BENCH_TRIAD,
+	BENCH_KERNEL_MAX,
+};
+
+static const char *kernel_name[] = { "copy", "scale", "add", "triad" };
+
+/* Arrays read and written per element, for the bandwidth calculation */
+static const int kernel_arrays[] = { 2, 2, 3, 3 };
+
+struct bench_opts {
+	size_t      n;          /* elements per array */
+	int         alignment;
+	size_t      offset;
+	int         nthreads;
+	int         iters;
+	int         node;
+	const char *daxpath;
+};
+
+struct bench {
+	const struct bench_opts *opts;
+	double                  *a, *b, *c;
+	pthread_barrier_t        barrier;
+	u_int64_t                best[BENCH_KERNEL_MAX];
+};
+
+struct bench_thread {
+	struct bench *b;
+	int           idx;
+};
+
+static void
+bench_kernel(enum bench_kernel k, double *a, double *b, double *c,
+	     size_t lo, size_t hi)
+{
+	const double s = BENCH_SCALAR;
+	size_t       i;
+
+	switch (k) {
+	case BENCH_COPY:
+		for (i = lo; i < hi; ++i)
+			c[i] = a[i];
+		break;
+	case BENCH_SCALE:
+		for (i = lo; i < hi; ++i)
+			b[i] = s * c[i];
+		break;
+	case BENCH_ADD:
+		for (i = lo; i < hi; ++i)
+			c[i] = a[i] + b[i];
+		break;
+	case BENCH_TRIAD:
+		for (i = lo; i < hi; ++i)
+			a[i] = b[i] + s * c[i];
+		break;
+	default:
+		break;
+	}
+}
+
+static void *
+bench_worker(void *rock)
+{
+	struct bench_thread     *t = rock;
+	struct bench            *b = t->b;
+	const struct bench_opts *opts = b->opts;
+	size_t                   lo, hi, i;
+	u_int64_t                start = 0, ns;
+	int                      it, k;
+
+	lo = opts->n * t->idx / opts->nthreads;
+	hi = opts->n * (t->idx + 1) / opts->nthreads;
+
+	for (i = lo; i < hi; ++i) {
+		b->a[i] = 1.0;
+		b->b[i] = 2.0;
+		b->c[i] = 0.0;
+	}
+
+	for (it = 0; it < opts->iters; ++it) {
+		for (k = 0; k < BENCH_KERNEL_MAX; ++k) {
+			pthread_barrier_wait(&b->barrier);
+			if (t->idx == 0)
+				start = get_cycles();
+
+			bench_kernel(k, b->a, b->b, b->c, lo, hi);
+
+			pthread_barrier_wait(&b->barrier);
+			if (t->idx == 0) {
+				ns = get_cycles() - start;
+				if (!b->best[k] || ns < b->best[k])
+					b->best[k] = ns;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+/* Pin thread @idx to the idx'th (mod count) CPU we're allowed to run on */
+static void
+bench_pin(pthread_attr_t *attr, const cpu_set_t *mine, int idx)
+{
+	cpu_set_t set;
+	int       cpu, n;
+
+	idx %= CPU_COUNT(mine);
+
+	for (cpu = 0, n = 0; cpu < CPU_SETSIZE; ++cpu) {
+		if (CPU_ISSET(cpu, mine) && n++ == idx)
+			break;
+	}
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+}
+
+/* Replay the kernels on scalars, as STREAM's checkSTREAMresults() does */
+static int
+bench_check(const struct bench *b)
+{
+	double a = 1.0, bv = 2.0, c = 0.0;
+	double err, d, expect[3];
+	double *arr[3] = { b->a, b->b, b->c };
+	size_t i;
+	int    it, j;
+
+	for (it = 0; it < b->opts->iters; ++it) {
+		c = a;
+		bv = BENCH_SCALAR * c;
+		c = a + bv;
+		a = bv + BENCH_SCALAR * c;
+	}
+
+	expect[0] = a;
+	expect[1] = bv;
+	expect[2] = c;
+
+	for (j = 0; j < 3; ++j) {
+		for (i = 0, err = 0; i < b->opts->n; ++i) {
+			d = arr[j][i] - expect[j];
+			err += d < 0 ? -d : d;
+		}
+		if (err / b->opts->n > 1e-13 * expect[j])
+			return -1;
+	}
+
+	return 0;
+}
+
+/* Return: 0 with @gbsv filled in, otherwise -errno */
+static int
+bench_run(enum bench_backing bk, const struct bench_opts *opts,
+	  double *gbsv)
+{
+	struct bench_thread *tv;
+	pthread_attr_t       attr;
+	pthread_t           *tidv;
+	struct bench         b = { .opts = opts };
+	struct cheap        *h;
+	cpu_set_t            mine;
+	size_t               bytes, sz;
+	int                  i, rc = 0;
+
+	bytes = opts->n * sizeof(double);
+	sz = 3 * (bytes + opts->alignment + opts->offset);
+
+	h = bench_backing_create(bk, 8, sz, opts->node, opts->daxpath);
+	if (!h)
+		return -errno;
+
+	b.a = cheap_memalign(h, opts->alignment, bytes);
+	cheap_malloc(h, opts->offset);
+	b.b = cheap_memalign(h, opts->alignment, bytes);
+	cheap_malloc(h, opts->offset);
+	b.c = cheap_memalign(h, opts->alignment, bytes);
+	if (!b.a || !b.b || !b.c) {
+		cheap_destroy(h);
+		return -ENOSPC;
+	}
+
+	if (sched_getaffinity(0, sizeof(mine), &mine)) {
+		CPU_ZERO(&mine);
+		CPU_SET(0, &mine);
+	}
+
+	tidv = calloc(opts->nthreads, sizeof(*tidv));
+	tv = calloc(opts->nthreads, sizeof(*tv));
+	if (!tidv || !tv) {
+		fprintf(stderr, "no memory for %d threads\n", opts->nthreads);
+		exit(1);
+	}
+
+	pthread_barrier_init(&b.barrier, NULL, opts->nthreads);
+
+	for (i = 0; i < opts->nthreads; ++i) {
+		tv[i].b = &b;
+		tv[i].idx = i;
+
+		pthread_attr_init(&attr);
+		bench_pin(&attr, &mine, i);
+		if (pthread_create(&tidv[i], &attr, bench_worker, &tv[i])) {
+			fprintf(stderr, "pthread_create failed\n");
+			exit(1);
+		}
+		pthread_attr_destroy(&attr);
+	}
+
+	for (i = 0; i < opts->nthreads; ++i)
+		pthread_join(tidv[i], NULL);
+
+	for (i = 0; i < BENCH_KERNEL_MAX; ++i)
+		gbsv[i] = (double)kernel_arrays[i] * bytes / b.best[i];
+
+	if (bench_check(&b))
+		rc = -EIO;
+
+	pthread_barrier_destroy(&b.barrier);
+	free(tv);
+	free(tidv);
+	cheap_destroy(h);
+
+	return rc;
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-n elements] [-A alignment] [-o offset] "
+		"[-t threads] [-i iterations] [-m backing] [-N node] "
+		"[-D daxpath]\n",
+		prog);
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	struct bench_opts opts = {
+		.n = 1ul << 25,
+		.alignment = 64,
+		.iters = 10,
+	};
+	double    gbsv[BENCH_KERNEL_MAX];
+	cpu_set_t mine;
+	int       first = 0, last = BENCH_BACKING_MAX - 1;
+	int       b, rc, k;
+	int       c;
+
+	while ((c = getopt(argc, argv, "n:A:o:t:i:m:N:D:")) != -1) {
+		switch (c) {
+		case 'n':
+			opts.n = strtoul(optarg, NULL, 0);
+			break;
+		case 'A':
+			opts.alignment = atoi(optarg);
+			break;
+		case 'o':
+			opts.offset = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			opts.nthreads = atoi(optarg);
+			break;
+		case 'i':
+			opts.iters = atoi(optarg);
+			break;
+		case 'm':
+			b = bench_backing_lookup(optarg);
+			if (b == BENCH_BACKING_MAX)
+				usage(argv[0]);
+			first = last = b;
+			break;
+		case 'N':
+			opts.node = atoi(optarg);
+			break;
+		case 'D':
+			opts.daxpath = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (!opts.nthreads) {
+		opts.nthreads = 1;
+		if (!sched_getaffinity(0, sizeof(mine), &mine))
+			opts.nthreads = CPU_COUNT(&mine);
+	}
+
+	if (opts.n < (size_t)opts.nthreads || opts.nthreads < 1 ||
+	    opts.alignment < 8 || (opts.alignment & (opts.alignment - 1)) ||
+	    opts.iters < 1 || opts.node < 0 || opts.node > 63)
+		usage(argv[0]);
+
+	printf("%zu elements (%zu bytes) per array, alignment %d, offset %zu, "
+	       "%d threads, best of %d\n",
+	       opts.n, opts.n * sizeof(double), opts.alignment, opts.offset,
+	       opts.nthreads, opts.iters);
+	printf("%10s", "backing");
+	for (k = 0; k < BENCH_KERNEL_MAX; ++k)
+		printf(" %10s", kernel_name[k]);
+	printf("   (GB/s)\n");
+
+	for (b = first; b <= last; ++b) {
+		rc = bench_run(b, &opts, gbsv);
+		if (rc && rc != -EIO) {
+			printf("%10s %10s (%s)\n", backing_name[b],
+			       "unavailable", strerror(-rc));
+			continue;
+		}
+
+		printf("%10s", backing_name[b]);
+		for (k = 0; k < BENCH_KERNEL_MAX; ++k)
+			printf(" %10.2f", gbsv[k]);
+		printf("%s\n", rc ? "   validation FAILED" : "");
+	}
+
+	return 0;
+}
@@ -0,0 +1,125 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+/*
+ * cheap_template_bench - cheap_t<> vs. the C API, ns per allocation
+ *
+ * Fills a cheap with -s byte allocations (resetting it when full) until
+ * -n allocations have been made, via:
+ *
+ *   c:        cheap_malloc() (or cheap_calloc() for the zeroed rows)
+ *   cheap_t:  cheap_t<>::malloc(), with the same alignment and policies
+ *
+ * for single threaded, CHEAP_F_MT, and zeroing cheaps.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+
+#include "cursor_heap.hpp"
+
+static volatile u_int64_t bench_sink;
+
+/* Allocate @n times from whatever @alloc allocates from */
+template <class Alloc, class Reset>
+static double
+bench_run(Alloc alloc, Reset reset, long n)
+{
+    u_int64_t start, sum = 0;
+    void     *p;
+    long      i;
+
+    reset();
+
+    start = get_cycles();
+    for (i = 0; i < n; ++i) {
+        p = alloc();
+        if (__builtin_expect(!p, 0)) {
+            reset();
+            p = alloc();
+        }
+        sum += (u_int64_t)p;
+    }
+    bench_sink = sum;
+
+    return (double)(get_cycles() - start) / n;
+}
+
+template <class T>
+static void
+bench_pair(const char *name, T &t, size_t size, long n, bool zeroed)
+{
+    struct cheap *h = t.get();
+    double        c_ns, t_ns;
+
+    auto reset = [&]() { cheap_reset(h, 0); };
+
+    /* Once to fault the cheap in */
+    bench_run([&]() { return cheap_malloc(h, size); }, reset, h->size / size);
+
+    if (zeroed)
+        c_ns = bench_run([&]() { return cheap_calloc(h, size); }, reset, n);
+    else
+        c_ns = bench_run([&]() { return cheap_malloc(h, size); }, reset, n);
+
+    t_ns = bench_run([&]() { return t.malloc(size); }, reset, n);
+
+    printf("%12s %10zu %12.2f %12.2f\n", name, size, c_ns, t_ns);
+}
+
+static void
+usage(const char *prog)
+{
+    fprintf(stderr, "usage: %s [-s allocsize] [-n allocations] [-H heapsize]\n", prog);
+    exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+    size_t heapsz = 64ul << 20;
+    size_t size = 32;
+    long   n = 100000000;
+    int    c;
+
+    while ((c = getopt(argc, argv, "s:n:H:")) != -1) {
+        switch (c) {
+        case 's':
+            size = strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            n = atol(optarg);
+            break;
+        case 'H':
+            heapsz = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    if (size < 1 || n < 1 || heapsz < size)
+        usage(argv[0]);
+
+    printf("%12s %10s %12s %12s\n", "policy", "size", "c ns", "cheap_t ns");
+
+    {
+        cheap_t<16> t(heapsz);
+
+        bench_pair("st", t, size, n, false);
+    }
+
+    {
+        cheap_t<16, cheap_threads::multi> t(heapsz);
+
+        bench_pair("mt", t, size, n, false);
+    }
+
+    {
+        cheap_t<16, cheap_threads::single, cheap_zeroing::zeroed> t(heapsz);
+
+        bench_pair("st zeroed", t, size, n, true);
+    }
+
+    return 0;
+}
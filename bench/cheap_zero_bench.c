@@ -0,0 +1,150 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+/*
+ * cheap_zero_bench - memset() vs. non-temporal zeroing, by size
+ *
+ * For each size from -m to -M (by factors of 4), zeroes a (pre-faulted)
+ * buffer of that size with:
+ *
+ *   memset:      plain memset()
+ *   nt:          cheap_zero_nt(), non-temporal stores at any size
+ *   cheap_zero:  cheap_zero(), i.e. memset() below CHEAP_ZERO_NT_MIN
+ *                and cheap_zero_nt() above it (what cheap_calloc() uses)
+ *
+ * and reports the zeroing rate, plus how long it then takes to re-read
+ * a small "hot" working set that was in cache before the zeroing (which
+ * is what large memset()s evict).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "cursor_heap.h"
+
+enum bench_mode {
+	BENCH_MEMSET,
+	BENCH_NT,
+	BENCH_CHEAP_ZERO,
+};
+
+static const char *mode_name[] = { "memset", "nt", "cheap_zero" };
+
+static u_int64_t
+bench_hot_read(const u_int64_t *hot, size_t hotsz)
+{
+	u_int64_t sum = 0;
+	size_t    i;
+
+	for (i = 0; i < hotsz / sizeof(*hot); i += CL_SIZE / sizeof(*hot))
+		sum += ((volatile const u_int64_t *)hot)[i];
+
+	return sum;
+}
+
+static void
+bench_run(enum bench_mode mode, char *buf, size_t size, const u_int64_t *hot,
+	  size_t hotsz, long iters, double *gbsp, double *hotnsp)
+{
+	u_int64_t zero_ns = 0, hot_ns = 0, start;
+	long      i;
+
+	for (i = 0; i < iters; ++i) {
+		bench_hot_read(hot, hotsz);
+
+		start = get_cycles();
+		switch (mode) {
+		case BENCH_MEMSET:
+			memset(buf, 0, size);
+			break;
+		case BENCH_NT:
+			cheap_zero_nt(buf, size);
+			break;
+		case BENCH_CHEAP_ZERO:
+			cheap_zero(buf, size);
+			break;
+		}
+		zero_ns += get_cycles() - start;
+
+		start = get_cycles();
+		bench_hot_read(hot, hotsz);
+		hot_ns += get_cycles() - start;
+	}
+
+	*gbsp = (double)size * iters / zero_ns;
+	*hotnsp = (double)hot_ns / iters;
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr,
+		"usage: %s [-m minsize] [-M maxsize] [-w hotsize] [-b bytes/size]\n",
+		prog);
+	exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+	size_t minsz = 4096, maxsz = 256ul << 20;
+	size_t hotsz = 256ul << 10;
+	size_t total = 1ul << 30;
+	u_int64_t *hot;
+	char  *buf;
+	size_t size;
+	double gbs, hotns;
+	int    mode;
+	int    c;
+
+	while ((c = getopt(argc, argv, "m:M:w:b:")) != -1) {
+		switch (c) {
+		case 'm':
+			minsz = strtoul(optarg, NULL, 0);
+			break;
+		case 'M':
+			maxsz = strtoul(optarg, NULL, 0);
+			break;
+		case 'w':
+			hotsz = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			total = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+
+	if (minsz < 1 || maxsz < minsz || hotsz < CL_SIZE || total < 1)
+		usage(argv[0]);
+
+	buf = aligned_alloc(4096, ALIGN(maxsz, 4096));
+	hot = aligned_alloc(4096, ALIGN(hotsz, 4096));
+	if (!buf || !hot) {
+		fprintf(stderr, "out of memory\n");
+		exit(1);
+	}
+	memset(buf, 1, maxsz);
+	memset(hot, 1, hotsz);
+
+	printf("non-temporal stores: %s, threshold %lu bytes, hot set %zu bytes\n",
+	       cheap_zero_isa(), CHEAP_ZERO_NT_MIN, hotsz);
+	printf("%12s %12s %12s %14s\n", "size", "mode", "GB/s", "hot read ns");
+
+	for (size = minsz; size <= maxsz; size *= 4) {
+		long iters = total / size ?: 1;
+
+		for (mode = BENCH_MEMSET; mode <= BENCH_CHEAP_ZERO; ++mode) {
+			bench_run(mode, buf, size, hot, hotsz, iters, &gbs, &hotns);
+			printf("%12zu %12s %12.2f %14.0f\n",
+			       size, mode_name[mode], gbs, hotns);
+		}
+	}
+
+	free(hot);
+	free(buf);
+
+	return 0;
+}
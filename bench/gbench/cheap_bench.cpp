@@ -0,0 +1,333 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+/*
+ * cheap_bench - allocator comparison suite (Google Benchmark)
+ *
+ * Each benchmark allocates batches of BENCH_BATCH items, with sizes drawn
+ * from one of several distributions, at the default or a given alignment,
+ * from 1 up to as many threads as there are CPUs.  The allocators:
+ *
+ *   cheap:     a (populated) cheap per thread, reset when full
+ *   cheap_mt:  one shared CHEAP_F_MT cheap, reset when full
+ *   malloc:    glibc malloc(), then free() of the batch
+ *   jemalloc, tcmalloc:
+ *              likewise, if the library was found at configure time
+ *              (they're dlopen()ed, so that all of them can coexist)
+ *
+ * Run with --benchmark_out=<file> --benchmark_out_format=json (or build
+ * the cheap_bench_json target) for results that can be tracked over time.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <dlfcn.h>
+#include <pthread.h>
+#include <stdlib.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "cursor_heap.hpp"
+
+#define BENCH_BATCH     256
+#define BENCH_NSIZES    4096            /* power of 2 */
+#define BENCH_HEAPSZ    (64ul << 20)
+
+struct bench_dist {
+    std::string           name;
+    std::vector<u_int32_t> sizev;
+};
+
+struct bench_malloc {
+    std::string name;
+    void *(*malloc)(size_t);
+    void (*free)(void *);
+    int (*memalign)(void **, size_t, size_t);
+};
+
+static u_int64_t
+bench_rand(u_int64_t *state)
+{
+    u_int64_t x = *state;
+
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+
+    return *state = x;
+}
+
+static std::vector<bench_dist>
+bench_dists(void)
+{
+    std::vector<bench_dist> distv;
+    u_int64_t               seed = 0x2545f4914f6cdd1dull;
+    bench_dist              d;
+    int                     i, k;
+
+    for (u_int32_t sz : { 16, 64, 256, 4096 }) {
+        d.name = "fixed:" + std::to_string(sz);
+        d.sizev.assign(BENCH_NSIZES, sz);
+        distv.push_back(d);
+    }
+
+    d.name = "uniform:16-512";
+    d.sizev.resize(BENCH_NSIZES);
+    for (i = 0; i < BENCH_NSIZES; ++i)
+        d.sizev[i] = 16 + bench_rand(&seed) % (512 - 16 + 1);
+    distv.push_back(d);
+
+    /* Mostly small, some large: half are 16-31 bytes, a quarter 32-63,
+     * and so on up to 16KiB.
+     */
+    d.name = "powerlaw:16-16384";
+    for (i = 0; i < BENCH_NSIZES; ++i) {
+        for (k = 0; k < 9 && bench_rand(&seed) % 2; ++k)
+            ;
+        d.sizev[i] = (16u << k) + bench_rand(&seed) % (16u << k);
+    }
+    distv.push_back(d);
+
+    return distv;
+}
+
+#if defined(CHEAP_BENCH_JEMALLOC) || defined(CHEAP_BENCH_TCMALLOC)
+static bool
+bench_malloc_open(const char *path, const char *name, bench_malloc *m)
+{
+    void *dl = dlopen(path, RTLD_NOW | RTLD_LOCAL | RTLD_DEEPBIND);
+
+    if (!dl)
+        return false;
+
+    /* tcmalloc's own names are unambiguous, so try those first */
+    m->name = name;
+    m->malloc = (void *(*)(size_t))dlsym(dl, "tc_malloc");
+    m->free = (void (*)(void *))dlsym(dl, "tc_free");
+    m->memalign = (int (*)(void **, size_t, size_t))dlsym(dl, "tc_posix_memalign");
+
+    if (!m->malloc || !m->free || !m->memalign) {
+        m->malloc = (void *(*)(size_t))dlsym(dl, "malloc");
+        m->free = (void (*)(void *))dlsym(dl, "free");
+        m->memalign = (int (*)(void **, size_t, size_t))dlsym(dl, "posix_memalign");
+    }
+
+    return m->malloc && m->free && m->memalign;
+}
+#endif
+
+static void
+bm_malloc(benchmark::State &state, const bench_malloc *m, const bench_dist *d,
+          size_t align)
+{
+    void * ptrv[BENCH_BATCH];
+    size_t i = state.thread_index() * 997, bytes = 0;
+    size_t sz;
+    int    j;
+
+    for (auto _ : state) {
+        for (j = 0; j < BENCH_BATCH; ++j) {
+            sz = d->sizev[i++ & (BENCH_NSIZES - 1)];
+
+            if (!align)
+                ptrv[j] = m->malloc(sz);
+            else if (m->memalign(&ptrv[j], align, sz))
+                ptrv[j] = NULL;
+
+            if (!ptrv[j]) {
+                state.SkipWithError("out of memory");
+                break;
+            }
+
+            *(char *)ptrv[j] = 0;
+            bytes += sz;
+        }
+
+        while (j-- > 0)
+            m->free(ptrv[j]);
+    }
+
+    state.SetItemsProcessed(state.iterations() * BENCH_BATCH);
+    state.SetBytesProcessed(bytes);
+}
+
+static inline void *
+bench_cheap_alloc(struct cheap *h, size_t align, size_t sz)
+{
+    return align ? cheap_memalign(h, align, sz) : cheap_malloc(h, sz);
+}
+
+static void
+bm_cheap(benchmark::State &state, const bench_dist *d, size_t align)
+{
+    struct cheap *h = cheap_create(16, BENCH_HEAPSZ);
+    size_t        i = state.thread_index() * 997, bytes = 0;
+    size_t        sz;
+    void *        p;
+    int           j;
+
+    if (!h || cheap_populate(h, 0, 1)) {
+        state.SkipWithError("cheap_create failed");
+        return;
+    }
+
+    for (auto _ : state) {
+        for (j = 0; j < BENCH_BATCH; ++j) {
+            sz = d->sizev[i++ & (BENCH_NSIZES - 1)];
+
+            p = bench_cheap_alloc(h, align, sz);
+            if (!p) {
+                cheap_reset(h, 0);
+                p = bench_cheap_alloc(h, align, sz);
+            }
+
+            *(char *)p = 0;
+            benchmark::DoNotOptimize(p);
+            bytes += sz;
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * BENCH_BATCH);
+    state.SetBytesProcessed(bytes);
+
+    cheap_destroy(h);
+}
+
+/* The shared cheap can only be reset while no thread is allocating, so
+ * each batch is allocated under the read side of a rwlock, and the first
+ * thread to find the cheap full resets it under the write side.
+ */
+static struct {
+    pthread_rwlock_t lock;
+    struct cheap *   h;
+    u_int64_t        gen;
+} bench_mt = { PTHREAD_RWLOCK_INITIALIZER, NULL, 0 };
+
+static void
+bm_cheap_mt(benchmark::State &state, const bench_dist *d, size_t align)
+{
+    size_t    i = state.thread_index() * 997, bytes = 0;
+    u_int64_t gen;
+    size_t    sz;
+    void *    p;
+    int       j;
+
+    /* Threads start (and stop) the timed loop together */
+    if (state.thread_index() == 0) {
+        bench_mt.h = cheap_create_mt(16, BENCH_HEAPSZ);
+        if (bench_mt.h)
+            cheap_populate(bench_mt.h, 0, 0);
+    }
+
+    for (auto _ : state) {
+        if (!bench_mt.h) {
+            state.SkipWithError("cheap_create_mt failed");
+            break;
+        }
+
+        for (j = 0; j < BENCH_BATCH;) {
+            pthread_rwlock_rdlock(&bench_mt.lock);
+            gen = bench_mt.gen;
+
+            for (; j < BENCH_BATCH; ++j) {
+                sz = d->sizev[i & (BENCH_NSIZES - 1)];
+
+                p = bench_cheap_alloc(bench_mt.h, align, sz);
+                if (!p)
+                    break;
+
+                *(char *)p = 0;
+                benchmark::DoNotOptimize(p);
+                bytes += sz;
+                ++i;
+            }
+            pthread_rwlock_unlock(&bench_mt.lock);
+
+            if (j < BENCH_BATCH) {
+                pthread_rwlock_wrlock(&bench_mt.lock);
+                if (bench_mt.gen == gen) {
+                    cheap_reset(bench_mt.h, 0);
+                    bench_mt.gen++;
+                }
+                pthread_rwlock_unlock(&bench_mt.lock);
+            }
+        }
+    }
+
+    state.SetItemsProcessed(state.iterations() * BENCH_BATCH);
+    state.SetBytesProcessed(bytes);
+
+    if (state.thread_index() == 0 && bench_mt.h) {
+        cheap_destroy(bench_mt.h);
+        bench_mt.h = NULL;
+    }
+}
+
+int
+main(int argc, char **argv)
+{
+    static std::vector<bench_dist>   distv = bench_dists();
+    static std::vector<bench_malloc> mallocv;
+    int                              maxthreads;
+#if defined(CHEAP_BENCH_JEMALLOC) || defined(CHEAP_BENCH_TCMALLOC)
+    bench_malloc                     m;
+#endif
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv))
+        return 1;
+
+    mallocv.push_back({ "malloc", malloc, free, posix_memalign });
+#ifdef CHEAP_BENCH_JEMALLOC
+    if (bench_malloc_open(CHEAP_BENCH_JEMALLOC, "jemalloc", &m))
+        mallocv.push_back(m);
+#endif
+#ifdef CHEAP_BENCH_TCMALLOC
+    if (bench_malloc_open(CHEAP_BENCH_TCMALLOC, "tcmalloc", &m))
+        mallocv.push_back(m);
+#endif
+
+    maxthreads = std::thread::hardware_concurrency();
+    if (maxthreads < 1)
+        maxthreads = 1;
+
+    /* Every size distribution at the default alignment, and 64 byte
+     * items at cache line and page alignment.
+     */
+    struct bench_case {
+        const bench_dist *dist;
+        size_t            align;
+    };
+    std::vector<bench_case> casev;
+
+    for (auto &d : distv)
+        casev.push_back({ &d, 0 });
+    for (size_t align : { 64, 4096 })
+        casev.push_back({ &distv[1], align });
+
+    for (auto &c : casev) {
+        std::string sfx = "/" + c.dist->name + "/align:" + std::to_string(c.align);
+
+        benchmark::RegisterBenchmark(("cheap" + sfx).c_str(), bm_cheap, c.dist,
+                                     c.align)
+            ->ThreadRange(1, maxthreads)
+            ->UseRealTime();
+
+        benchmark::RegisterBenchmark(("cheap_mt" + sfx).c_str(), bm_cheap_mt,
+                                     c.dist, c.align)
+            ->ThreadRange(1, maxthreads)
+            ->UseRealTime();
+
+        for (auto &ma : mallocv)
+            benchmark::RegisterBenchmark((ma.name + sfx).c_str(), bm_malloc, &ma,
+                                         c.dist, c.align)
+                ->ThreadRange(1, maxthreads)
+                ->UseRealTime();
+    }
+
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+
+    return 0;
+}
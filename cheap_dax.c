@@ -77,3 +77,87 @@ cheap_devdax_get_file_size(const char *fname, size_t *size)
 	*size = (size_t)size_i;
 	return 0;
 }
+
+/*
+ * A devdax device can only be mapped in units of its alignment (2MiB or
+ * 1GiB, the page size it was created with), so that's the granularity
+ * of any range of it.  pmem block devices and regular files (including
+ * fs-dax files) can be mapped at any page boundary.
+ */
+int
+cheap_devdax_get_align(const char *fname, size_t *align)
+{
+	static const char *attrv[] = { "align", "device/align" };
+	char spath[PATH_MAX];
+	u_int64_t align_i;
+	struct stat st;
+	FILE *sfile;
+	size_t i;
+	int rc;
+
+	rc = stat(fname, &st);
+	if (rc < 0) {
+		fprintf(stderr, "%s: failed to stat file %s (%s)\n",
+			__func__, fname, strerror(errno));
+		return -errno;
+	}
+
+	switch (st.st_mode & S_IFMT) {
+	case S_IFBLK:
+	case S_IFREG:
+		*align = sysconf(_SC_PAGESIZE);
+		return 0;
+	case S_IFCHR:
+		break;
+	default:
+		fprintf(stderr, "invalid dax device %s\n", fname);
+		return -EINVAL;
+	}
+
+	/* Kernels before 5.10 only have the region's alignment */
+	for (i = 0; i < sizeof(attrv) / sizeof(attrv[0]); ++i) {
+		snprintf(spath, PATH_MAX, "/sys/dev/char/%d:%d/%s",
+			 major(st.st_rdev), minor(st.st_rdev), attrv[i]);
+
+		sfile = fopen(spath, "r");
+		if (!sfile)
+			continue;
+
+		rc = fscanf(sfile, "%lu", &align_i);
+		fclose(sfile);
+
+		if (rc == 1 && align_i > 0) {
+			*align = (size_t)align_i;
+			return 0;
+		}
+	}
+
+	/* The devdax default */
+	*align = 2ul << 20;
+	return 0;
+}
+
+/*
+ * Lay out @n devices back to back, as cheap_create_dax_multi() maps
+ * them.  A device can only be mapped at a multiple of its alignment and
+ * the heap must be contiguous, so a device that would start part way
+ * through one of its own units (e.g. a 2MiB devdax after a regular file
+ * whose size isn't a multiple of 2MiB) can't follow the ones before it.
+ */
+int
+cheap_dax_concat(struct cheap_dax_dev *devv, int n, size_t *total)
+{
+	size_t off = 0;
+	int i;
+
+	for (i = 0; i < n; ++i) {
+		if (off % devv[i].align)
+			return -EINVAL;
+
+		devv[i].off = off;
+		off += devv[i].size;
+	}
+
+	*total = off;
+	return 0;
+}
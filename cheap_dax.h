@@ -6,6 +6,52 @@
 #include <sys/types.h>
 
 int cheap_devdax_get_file_size(const char *fname, size_t *size);
+int cheap_devdax_get_align(const char *fname, size_t *align);
+
+/*
+ * struct cheap_dax_dev - one device of a multi-device cheap
+ * @fd:     open fd of the device
+ * @size:   bytes of it to map (a multiple of @align)
+ * @align:  its mapping alignment (see cheap_devdax_get_align())
+ * @off:    where it starts in the heap, when concatenated
+ */
+struct cheap_dax_dev {
+	int    fd;
+	size_t size;
+	size_t align;
+	size_t off;
+};
+
+int cheap_dax_concat(struct cheap_dax_dev *devv, int n, size_t *total);
+
+/* cheap_persist() for a mapping that has no cheap yet (@mapsync as set
+ * by mapping it), e.g. while formatting the header.
+ */
+int cheap_dax_persist(const void *p, size_t len, int mapsync);
+
+#define CHEAP_DAX_MAGIC         (0x5841445041454843ull)  /* "CHEAPDAX" */
+#define CHEAP_DAX_VERSION       (1)
+
+/*
+ * struct cheap_dax_hdr - on-media header of a persistent cheap
+ * @magic:      CHEAP_DAX_MAGIC once the header is valid
+ * @version:    CHEAP_DAX_VERSION
+ * @alignment:  default allocation alignment
+ * @size:       bytes from the header to the end of the heap
+ * @base:       offset of the first allocatable byte (the device alignment,
+ *              so that the heap stays huge page aligned on devdax)
+ * @cursor:     offset of the cursor, as of the last cheap_sync()
+ *
+ * Offsets are from the start of the header.
+ */
+struct cheap_dax_hdr {
+	u_int64_t magic;
+	u_int32_t version;
+	u_int32_t alignment;
+	u_int64_t size;
+	u_int64_t base;
+	u_int64_t cursor;
+};
 
 
 #endif
@@ -0,0 +1,150 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include "cheap_numa.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+/* Raw syscalls, so that we don't depend on libnuma */
+
+static long
+sys_mbind(void *addr, unsigned long len, int mode,
+	  const unsigned long *nodemask, unsigned long maxnode,
+	  unsigned int flags)
+{
+	return syscall(SYS_mbind, addr, len, mode, nodemask, maxnode, flags);
+}
+
+static long
+sys_move_pages(unsigned long count, void **pages, const int *nodes,
+	       int *status, int flags)
+{
+	return syscall(SYS_move_pages, 0, count, pages, nodes, status, flags);
+}
+
+/*
+ * cheap_numa_list_read() - read a sysfs cpu or node list into a bitmap
+ * @path:   e.g. /sys/devices/system/node/online
+ * @bitv:   bitv[n] is set to 1 for each n in the list
+ * @nbits:  number of elements in @bitv (larger numbers are ignored)
+ *
+ * The lists look like "0", "0-3" or "0,2-3,8-11".
+ *
+ * Return: the largest number in the list, otherwise -errno.
+ */
+int
+cheap_numa_list_read(const char *path, u_int8_t *bitv, int nbits)
+{
+	char  buf[4096];
+	char *s, *end;
+	long  lo, hi, i;
+	int   max = -ENOENT;
+	FILE *fp;
+
+	fp = fopen(path, "r");
+	if (!fp)
+		return -errno;
+
+	s = fgets(buf, sizeof(buf), fp);
+	fclose(fp);
+	if (!s)
+		return -ENOENT;
+
+	while (*s >= '0' && *s <= '9') {
+		lo = hi = strtol(s, &end, 10);
+		if (*end == '-')
+			hi = strtol(end + 1, &end, 10);
+
+		for (i = lo; i <= hi && i < nbits; ++i)
+			bitv[i] = 1;
+		if (hi > max)
+			max = hi;
+
+		s = (*end == ',') ? end + 1 : end;
+	}
+
+	return max;
+}
+
+/*
+ * cheap_numa_max_node() - return the highest possible NUMA node number
+ *
+ * Returns 0 if the kernel has no NUMA support (or no sysfs).
+ */
+int
+cheap_numa_max_node(void)
+{
+	int max;
+
+	max = cheap_numa_list_read("/sys/devices/system/node/possible",
+				   NULL, 0);
+
+	return max < 0 ? 0 : max;
+}
+
+/*
+ * cheap_numa_mbind() - apply a memory policy to a range
+ * @addr:     page aligned start of the range
+ * @len:      length of the range
+ * @mpol:     MPOL_BIND, MPOL_PREFERRED or MPOL_INTERLEAVE
+ * @nodemask: nodes the policy applies to
+ *
+ * Return: 0 on success, otherwise -errno.
+ */
+int
+cheap_numa_mbind(void *addr, size_t len, int mpol, u_int64_t nodemask)
+{
+	unsigned long mask = nodemask;
+
+	if (sys_mbind(addr, len, mpol, &mask, CHEAP_NUMA_NODES_MAX + 1, 0))
+		return -errno;
+
+	return 0;
+}
+
+/*
+ * cheap_numa_residency() - count resident bytes in a range by node
+ * @addr:    page aligned start of the range
+ * @len:     length of the range
+ * @pagesz:  size of the pages backing the range
+ * @bytesv:  bytesv[n] is incremented by the bytes resident on node n
+ * @nnodes:  number of elements in @bytesv
+ *
+ * Pages that are not resident, or that are on nodes beyond @nnodes,
+ * are not counted.
+ *
+ * Return: total resident bytes in the range, otherwise -errno.
+ */
+ssize_t
+cheap_numa_residency(void *addr, size_t len, size_t pagesz,
+		     size_t *bytesv, int nnodes)
+{
+	enum { BATCH = 1024 };
+	void  *pagev[BATCH];
+	int    statusv[BATCH];
+	char  *p = addr, *end = p + len;
+	ssize_t total = 0;
+	int    i, n;
+
+	while (p < end) {
+		for (n = 0; n < BATCH && p < end; ++n, p += pagesz)
+			pagev[n] = p;
+
+		if (sys_move_pages(n, pagev, NULL, statusv, 0))
+			return -errno;
+
+		for (i = 0; i < n; ++i) {
+			if (statusv[i] < 0 || statusv[i] >= nnodes)
+				continue;
+
+			bytesv[statusv[i]] += pagesz;
+			total += pagesz;
+		}
+	}
+
+	return total;
+}
@@ -0,0 +1,17 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef _H_CHEAP_NUMA
+#define _H_CHEAP_NUMA
+
+#include <sys/types.h>
+
+/* Number of nodes a nodemask can name (it's a single u_int64_t) */
+#define CHEAP_NUMA_NODES_MAX    64
+
+int cheap_numa_list_read(const char *path, u_int8_t *bitv, int nbits);
+int cheap_numa_max_node(void);
+int cheap_numa_mbind(void *addr, size_t len, int mpol, u_int64_t nodemask);
+ssize_t cheap_numa_residency(void *addr, size_t len, size_t pagesz,
+			     size_t *bytesv, int nnodes);
+
+#endif
@@ -0,0 +1,185 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+/*
+ * Making allocations in DAX/pmem backed cheaps durable
+ *
+ * When a mapping is synchronous (devdax, or an fs-dax file mapped with
+ * MAP_SYNC), stores reach the media as soon as they leave the CPU caches,
+ * so writing back the affected cache lines and fencing is all it takes.
+ * Anything else (a pmem block device or file in the page cache) needs
+ * msync().  The cache line write-back instruction is picked once, at
+ * first use: CLWB (which leaves the line in the cache), else CLFLUSHOPT,
+ * else CLFLUSH.
+ */
+
+#include <stdint.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "cursor_heap.h"
+#include "cheap_dax.h"
+
+#if defined(__x86_64__)
+#include <cpuid.h>
+#include <immintrin.h>
+
+#define CHEAP_FLUSH_X86 1
+#endif
+
+typedef void cheap_flush_fn(char *, char *);
+
+#if CHEAP_FLUSH_X86
+
+/* Each of these writes back the cache lines in [p, end), where p is
+ * cache line aligned.  The caller fences.
+ */
+
+__attribute__((target("clwb")))
+static void
+cheap_flush_clwb(char *p, char *end)
+{
+	for (; p < end; p += CL_SIZE)
+		_mm_clwb(p);
+}
+
+__attribute__((target("clflushopt")))
+static void
+cheap_flush_clflushopt(char *p, char *end)
+{
+	for (; p < end; p += CL_SIZE)
+		_mm_clflushopt(p);
+}
+
+/* CLFLUSH is baseline on x86_64 (and ordered, but slow) */
+static void
+cheap_flush_clflush(char *p, char *end)
+{
+	for (; p < end; p += CL_SIZE)
+		_mm_clflush(p);
+}
+
+#endif
+
+struct cheap_flush_isa {
+	const char     *name;
+	cheap_flush_fn *fn;
+	int             supported;
+};
+
+static struct cheap_flush_isa cheap_flush_isav[] = {
+#if CHEAP_FLUSH_X86
+	{ .name = "clwb",       .fn = cheap_flush_clwb,       .supported = 0 },
+	{ .name = "clflushopt", .fn = cheap_flush_clflushopt, .supported = 0 },
+	{ .name = "clflush",    .fn = cheap_flush_clflush,    .supported = 0 },
+#endif
+	{ .name = NULL, .fn = NULL, .supported = 0 },
+};
+
+static struct cheap_flush_isa *cheap_flush_cur;
+
+static void
+cheap_flush_probe(void)
+{
+#if CHEAP_FLUSH_X86
+	unsigned int eax, ebx, ecx, edx;
+
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+		cheap_flush_isav[2].supported = !!(edx & (1u << 19));
+
+	if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx)) {
+		cheap_flush_isav[0].supported = !!(ebx & (1u << 24));
+		cheap_flush_isav[1].supported = !!(ebx & (1u << 23));
+	}
+#endif
+}
+
+static struct cheap_flush_isa *
+cheap_flush_get(void)
+{
+	struct cheap_flush_isa *isa;
+
+	isa = __atomic_load_n(&cheap_flush_cur, __ATOMIC_ACQUIRE);
+	if (!isa) {
+		cheap_flush_select(NULL);
+		isa = cheap_flush_cur;
+	}
+
+	return isa;
+}
+
+int
+cheap_flush_select(const char *name)
+{
+	struct cheap_flush_isa *isa;
+
+	cheap_flush_probe();
+
+	/* The first one supported (they're in order of preference) */
+	for (isa = cheap_flush_isav; isa->name; ++isa) {
+		if (name && strcmp(name, isa->name))
+			continue;
+		if (isa->supported)
+			break;
+		if (name)
+			return -ENOTSUP;
+	}
+
+	if (name && !isa->name)
+		return -EINVAL;
+
+	/* Racing threads all pick the same thing */
+	__atomic_store_n(&cheap_flush_cur, isa, __ATOMIC_RELEASE);
+
+	return 0;
+}
+
+const char *
+cheap_flush_isa(void)
+{
+	return cheap_flush_get()->name ?: "none";
+}
+
+void
+cheap_flush(const void *p, size_t len)
+{
+	struct cheap_flush_isa *isa = cheap_flush_get();
+	uintptr_t start = (uintptr_t)p & ~(uintptr_t)(CL_SIZE - 1);
+
+	if (!isa->fn || !len)
+		return;
+
+	isa->fn((char *)start, (char *)p + len);
+
+#if CHEAP_FLUSH_X86
+	/* CLWB and CLFLUSHOPT are weakly ordered */
+	_mm_sfence();
+#endif
+}
+
+int
+cheap_dax_persist(const void *p, size_t len, int mapsync)
+{
+	uintptr_t start = (uintptr_t)p & PAGE_MASK;
+
+	if (mapsync && cheap_flush_get()->fn) {
+		cheap_flush(p, len);
+		return 0;
+	}
+
+	if (msync((void *)start, (uintptr_t)p + len - start, MS_SYNC))
+		return -errno;
+
+	return 0;
+}
+
+int
+cheap_persist(struct cheap *h, const void *p, size_t len)
+{
+	assert(h->magic == (u_int64_t)h);
+
+	if (!h->mfd)
+		return -EINVAL;
+
+	return cheap_dax_persist(p, len, h->mapsync);
+}
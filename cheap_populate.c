@@ -0,0 +1,383 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+/*
+ * Pre-faulting (populating) cheaps
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sched.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "cursor_heap.h"
+#include "cheap_numa.h"
+#include "cheap_populate.h"
+#include "minmax.h"
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE     23
+#endif
+
+/* Don't bother starting a thread for less than this */
+#define CHEAP_POPULATE_MIN      (64ul << 20)
+
+struct cheap_populate_work {
+	pthread_t tid;
+	char     *addr;
+	size_t    len;
+	size_t    pagesz;
+	int       rc;
+};
+
+/* Fault in [addr, addr + len) for writing without changing its contents
+ * (which matters for DAX, and for cheaps already in use).
+ */
+static int
+cheap_populate_range(char *addr, size_t len, size_t pagesz)
+{
+	char *end = addr + len;
+
+	if (!madvise(addr, len, MADV_POPULATE_WRITE))
+		return 0;
+
+	/* Kernels before 5.14 don't have MADV_POPULATE_WRITE */
+	if (errno != EINVAL)
+		return -errno;
+
+	for (; addr < end; addr += pagesz)
+		__atomic_fetch_add(addr, 0, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+static void *
+cheap_populate_worker(void *rock)
+{
+	struct cheap_populate_work *work = rock;
+
+	work->rc = cheap_populate_range(work->addr, work->len, work->pagesz);
+
+	return NULL;
+}
+
+/* Restrict @attr to the CPUs of the caller's node, so that first touch
+ * puts the pages where the caller would have.  Returns 0 if the caller's
+ * node could not be determined (and @attr is left alone).
+ */
+static int
+cheap_populate_local(pthread_attr_t *attr, cpu_set_t *set)
+{
+	u_int8_t cpuv[CPU_SETSIZE] = { 0 };
+	unsigned int cpu, node;
+	char path[128];
+	cpu_set_t mine;
+	int i;
+
+	if (syscall(SYS_getcpu, &cpu, &node, NULL))
+		return 0;
+
+	snprintf(path, sizeof(path),
+		 "/sys/devices/system/node/node%u/cpulist", node);
+	if (cheap_numa_list_read(path, cpuv, CPU_SETSIZE) < 0)
+		return 0;
+
+	if (sched_getaffinity(0, sizeof(mine), &mine))
+		return 0;
+
+	CPU_ZERO(set);
+	for (i = 0; i < CPU_SETSIZE; ++i) {
+		if (cpuv[i] && CPU_ISSET(i, &mine))
+			CPU_SET(i, set);
+	}
+
+	if (!CPU_COUNT(set))
+		return 0;
+
+	return !pthread_attr_setaffinity_np(attr, sizeof(*set), set);
+}
+
+/*
+ * cheap_populate_mem() - populate part of a cheap's mapping
+ * @h:         the cheap (for its page size and NUMA policy)
+ * @mem:       page aligned start of the range
+ * @len:       length of the range
+ * @nthreads:  number of threads to split the work across (0 for auto)
+ *
+ * Return: 0 on success, otherwise -errno.
+ */
+int
+cheap_populate_mem(struct cheap *h, void *mem, size_t len, int nthreads)
+{
+	struct cheap_populate_work *workv;
+	pthread_attr_t attr;
+	cpu_set_t set;
+	size_t chunk, off;
+	int i, n, rc;
+
+	if (nthreads <= 0) {
+		cpu_set_t mine;
+
+		nthreads = 1;
+		if (!sched_getaffinity(0, sizeof(mine), &mine))
+			nthreads = CPU_COUNT(&mine);
+		nthreads = min_t(size_t, nthreads, len / CHEAP_POPULATE_MIN);
+		nthreads = max_t(int, nthreads, 1);
+	}
+
+	chunk = max_t(size_t, ALIGN(len / nthreads, h->pagesz), h->pagesz);
+	if (nthreads == 1 || chunk >= len)
+		return cheap_populate_range(mem, len, h->pagesz);
+
+	workv = calloc(nthreads, sizeof(*workv));
+	if (!workv)
+		return -ENOMEM;
+
+	pthread_attr_init(&attr);
+
+	/* A NUMA policy places the pages no matter who touches them */
+	if (!h->numa_mpol)
+		cheap_populate_local(&attr, &set);
+
+	for (n = 0, off = 0; n < nthreads && off < len; ++n, off += chunk) {
+		workv[n].addr = (char *)mem + off;
+		workv[n].len = min_t(size_t, chunk, len - off);
+		workv[n].pagesz = h->pagesz;
+
+		/* The caller does the last chunk itself */
+		if (off + chunk >= len)
+			break;
+
+		if (pthread_create(&workv[n].tid, &attr, cheap_populate_worker,
+				   &workv[n])) {
+			workv[n].len = len - off;
+			break;
+		}
+	}
+
+	cheap_populate_worker(&workv[n]);
+	rc = workv[n].rc;
+
+	for (i = 0; i < n; ++i) {
+		pthread_join(workv[i].tid, NULL);
+		if (workv[i].rc && !rc)
+			rc = workv[i].rc;
+	}
+
+	pthread_attr_destroy(&attr);
+	free(workv);
+
+	return rc;
+}
+
+int
+cheap_populate(struct cheap *h, size_t len, int nthreads)
+{
+	u_int64_t end;
+	int rc;
+
+	assert(h->magic == (u_int64_t)h);
+
+	if (!len || len > h->size - (h->base - (u_int64_t)h->mem))
+		len = h->size - (h->base - (u_int64_t)h->mem);
+
+	/* Whole pages, from the start of the mapping */
+	end = ALIGN(h->base + len, h->pagesz);
+	end = min_t(u_int64_t, end, (u_int64_t)h->mem + h->size);
+
+	rc = cheap_populate_mem(h, h->mem, end - (u_int64_t)h->mem, nthreads);
+	if (rc)
+		return rc;
+
+	/* Let cheap_trim() know these pages are resident */
+	if (h->brk < end)
+		h->brk = end;
+
+	return 0;
+}
+
+/* The prefault thread polls the cursor, starting at this interval and
+ * backing off (doubling) up to the max while there's nothing to do.
+ */
+#define CHEAP_PREFAULT_POLL_MIN_US      (50)
+#define CHEAP_PREFAULT_POLL_MAX_US      (10 * 1000)
+
+struct cheap_prefault {
+	pthread_t       tid;
+	pthread_mutex_t lock;
+	pthread_cond_t  cv;
+	struct cheap   *h;
+	size_t          window;
+	size_t          chunk;
+	int             stop;
+	u_int64_t       base;   /* base of the segment being prefaulted */
+	u_int64_t       done;   /* populated up to here */
+};
+
+/* Snapshot the bounds of the current segment (of a CHEAP_F_GROW cheap,
+ * which cheap_grow() changes under seg_lock).
+ */
+static void
+cheap_prefault_bounds(struct cheap *h, u_int64_t *basep, u_int64_t *endp,
+		      u_int64_t *brkp)
+{
+	if (h->seg)
+		pthread_mutex_lock(&h->seg_lock);
+
+	*basep = h->base;
+	*endp = (u_int64_t)h->mem + h->size;
+	*brkp = __atomic_load_n(&h->brk, __ATOMIC_RELAXED);
+
+	if (h->seg)
+		pthread_mutex_unlock(&h->seg_lock);
+}
+
+static void *
+cheap_prefault_main(void *rock)
+{
+	struct cheap_prefault *pf = rock;
+	struct cheap *h = pf->h;
+	u_int64_t base, end, brk, cur, target, next;
+	struct timespec ts;
+	long pollus = CHEAP_PREFAULT_POLL_MIN_US;
+
+	pthread_mutex_lock(&pf->lock);
+
+	while (!pf->stop) {
+		cheap_prefault_bounds(h, &base, &end, &brk);
+
+		/* A new segment (or the first time around) */
+		if (base != pf->base) {
+			pf->base = base;
+			pf->done = max_t(u_int64_t, brk, PAGE_ALIGN(base));
+		}
+
+		cur = __atomic_load_n(&h->cursorp, __ATOMIC_RELAXED);
+		if (cur < base || cur > end)
+			cur = end;
+
+		target = ALIGN(cur + pf->window, h->pagesz);
+		target = min_t(u_int64_t, target, end);
+
+		if (pf->done < target) {
+			next = min_t(u_int64_t, pf->done + pf->chunk, target);
+			next = min_t(u_int64_t, ALIGN(next, h->pagesz), end);
+
+			if (cheap_populate_mem(h, (void *)pf->done,
+					       next - pf->done, 1))
+				break;
+
+			pf->done = next;
+
+			/* Let cheap_trim() know these pages are resident */
+			brk = __atomic_load_n(&h->brk, __ATOMIC_RELAXED);
+			while (brk < next &&
+			       !__atomic_compare_exchange_n(&h->brk, &brk, next, 1,
+							    __ATOMIC_RELAXED,
+							    __ATOMIC_RELAXED))
+				;
+
+			pollus = CHEAP_PREFAULT_POLL_MIN_US;
+			continue;
+		}
+
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += pollus * 1000;
+		if (ts.tv_nsec >= 1000000000) {
+			ts.tv_sec++;
+			ts.tv_nsec -= 1000000000;
+		}
+		pthread_cond_timedwait(&pf->cv, &pf->lock, &ts);
+
+		pollus = min_t(long, pollus * 2, CHEAP_PREFAULT_POLL_MAX_US);
+	}
+
+	pthread_mutex_unlock(&pf->lock);
+
+	return NULL;
+}
+
+int
+cheap_prefault_start(struct cheap *h, size_t window, size_t chunk)
+{
+	struct cheap_prefault *pf;
+	int rc;
+
+	assert(h->magic == (u_int64_t)h);
+
+	if (h->prefault)
+		return -EBUSY;
+
+	pf = calloc(1, sizeof(*pf));
+	if (!pf)
+		return -ENOMEM;
+
+	pf->h = h;
+	pf->window = window ?: CHEAP_PREFAULT_WINDOW;
+	pf->chunk = max_t(size_t, chunk ?: CHEAP_PREFAULT_CHUNK, PAGE_SIZE);
+	pthread_mutex_init(&pf->lock, NULL);
+	pthread_cond_init(&pf->cv, NULL);
+
+	rc = pthread_create(&pf->tid, NULL, cheap_prefault_main, pf);
+	if (rc) {
+		pthread_cond_destroy(&pf->cv);
+		pthread_mutex_destroy(&pf->lock);
+		free(pf);
+		return -rc;
+	}
+
+	h->prefault = pf;
+
+	return 0;
+}
+
+void
+cheap_prefault_stop(struct cheap *h)
+{
+	struct cheap_prefault *pf = h->prefault;
+
+	assert(h->magic == (u_int64_t)h);
+
+	if (!pf)
+		return;
+
+	pthread_mutex_lock(&pf->lock);
+	pf->stop = 1;
+	pthread_cond_signal(&pf->cv);
+	pthread_mutex_unlock(&pf->lock);
+
+	pthread_join(pf->tid, NULL);
+
+	h->prefault = NULL;
+	pthread_cond_destroy(&pf->cv);
+	pthread_mutex_destroy(&pf->lock);
+	free(pf);
+}
+
+void
+cheap_prefault_pause(struct cheap *h)
+{
+	if (h->prefault)
+		pthread_mutex_lock(&h->prefault->lock);
+}
+
+void
+cheap_prefault_resume(struct cheap *h)
+{
+	struct cheap_prefault *pf = h->prefault;
+
+	if (!pf)
+		return;
+
+	/* cheap_trim() may have released pages we populated */
+	if (pf->done > h->brk)
+		pf->done = h->brk;
+
+	pthread_cond_signal(&pf->cv);
+	pthread_mutex_unlock(&pf->lock);
+}
@@ -0,0 +1,14 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#ifndef _H_CHEAP_POPULATE
+#define _H_CHEAP_POPULATE
+
+#include <sys/types.h>
+
+struct cheap;
+
+int cheap_populate_mem(struct cheap *h, void *mem, size_t len, int nthreads);
+void cheap_prefault_pause(struct cheap *h);
+void cheap_prefault_resume(struct cheap *h);
+
+#endif
@@ -0,0 +1,223 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+/*
+ * Per-NUMA-node cheap sets
+ */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sched.h>
+#include <errno.h>
+
+#include "cursor_heap.h"
+#include "cheap_numa.h"
+
+/* Build the machine's CPU to node map from sysfs.  A machine (or kernel)
+ * without NUMA looks like a single node with every CPU on it.
+ */
+static int
+cheap_topo_discover(struct cheap_topo *topo, int **cpu_nodep)
+{
+	u_int8_t  nodev[CHEAP_NUMA_NODES_MAX] = { 0 };
+	u_int8_t *cpuv;
+	char      path[128];
+	int      *cpu_node;
+	int       nnodes, ncpus;
+	int       node, cpu;
+
+	ncpus = cheap_numa_list_read("/sys/devices/system/cpu/possible",
+				     NULL, 0) + 1;
+	if (ncpus < 1)
+		ncpus = sysconf(_SC_NPROCESSORS_CONF);
+	if (ncpus < 1)
+		ncpus = 1;
+
+	nnodes = cheap_numa_max_node() + 1;
+	if (nnodes > CHEAP_NUMA_NODES_MAX)
+		nnodes = CHEAP_NUMA_NODES_MAX;
+
+	cpu_node = calloc(ncpus, sizeof(*cpu_node));
+	cpuv = malloc(ncpus);
+	if (!cpu_node || !cpuv) {
+		free(cpu_node);
+		free(cpuv);
+		return -ENOMEM;
+	}
+
+	cheap_numa_list_read("/sys/devices/system/node/online",
+			     nodev, CHEAP_NUMA_NODES_MAX);
+
+	for (node = 0; node < nnodes; ++node) {
+		if (!nodev[node])
+			continue;
+
+		snprintf(path, sizeof(path),
+			 "/sys/devices/system/node/node%d/cpulist", node);
+
+		memset(cpuv, 0, ncpus);
+		if (cheap_numa_list_read(path, cpuv, ncpus) < 0)
+			continue;
+
+		for (cpu = 0; cpu < ncpus; ++cpu) {
+			if (cpuv[cpu])
+				cpu_node[cpu] = node;
+		}
+	}
+
+	free(cpuv);
+
+	topo->nnodes = nnodes;
+	topo->ncpus = ncpus;
+	topo->cpu_node = cpu_node;
+	*cpu_nodep = cpu_node;
+
+	return 0;
+}
+
+static struct cheap_set *
+cheap_set_create_impl(int alignment, size_t size, u_int32_t flags,
+		      const struct cheap_topo *topo)
+{
+	struct cheap_numa_policy policy;
+	struct cheap_set *set;
+	int node, cpu;
+
+	if (topo->nnodes < 1 || topo->nnodes > CHEAP_NUMA_NODES_MAX ||
+	    topo->ncpus < 1)
+		return NULL;
+
+	set = calloc(1, sizeof(*set));
+	if (!set)
+		return NULL;
+
+	set->magic = (u_int64_t)set;
+	set->nnodes = topo->nnodes;
+	set->ncpus = topo->ncpus;
+
+	set->cpu_node = calloc(set->ncpus, sizeof(*set->cpu_node));
+	set->heapv = calloc(set->nnodes, sizeof(*set->heapv));
+	if (!set->cpu_node || !set->heapv)
+		goto errout;
+
+	for (cpu = 0; cpu < set->ncpus; ++cpu) {
+		node = topo->cpu_node[cpu];
+		if (node < 0 || node >= set->nnodes)
+			node = 0;
+		set->cpu_node[cpu] = node;
+	}
+
+	flags |= CHEAP_F_MT;
+
+	for (node = 0; node < set->nnodes; ++node) {
+		policy.mode = CHEAP_NUMA_PREFERRED;
+		policy.nodemask = 1ul << node;
+		policy.flags = flags;
+
+		set->heapv[node] = cheap_create_numa(alignment, size, &policy);
+		if (!set->heapv[node])
+			set->heapv[node] = cheap_create_flags(alignment, size, flags);
+		if (!set->heapv[node])
+			goto errout;
+	}
+
+	return set;
+
+errout:
+	cheap_set_destroy(set);
+
+	return NULL;
+}
+
+struct cheap_set *
+cheap_set_create_topo(int alignment, size_t size, u_int32_t flags,
+		      const struct cheap_topo *topo)
+{
+	return cheap_set_create_impl(alignment, size, flags, topo);
+}
+
+struct cheap_set *
+cheap_set_create(int alignment, size_t size, u_int32_t flags)
+{
+	struct cheap_topo topo;
+	struct cheap_set *set;
+	int *cpu_node;
+
+	if (cheap_topo_discover(&topo, &cpu_node))
+		return NULL;
+
+	set = cheap_set_create_impl(alignment, size, flags, &topo);
+
+	free(cpu_node);
+
+	return set;
+}
+
+void
+cheap_set_destroy(struct cheap_set *set)
+{
+	int node;
+
+	if (!set)
+		return;
+
+	assert(set->magic == (u_int64_t)set);
+
+	for (node = 0; set->heapv && node < set->nnodes; ++node)
+		cheap_destroy(set->heapv[node]);
+
+	set->magic = ~set->magic;
+	free(set->heapv);
+	free(set->cpu_node);
+	free(set);
+}
+
+struct cheap *
+cheap_set_local(struct cheap_set *set)
+{
+	int cpu = sched_getcpu();
+
+	assert(set->magic == (u_int64_t)set);
+
+	if (cpu < 0 || cpu >= set->ncpus)
+		return set->heapv[0];
+
+	return set->heapv[set->cpu_node[cpu]];
+}
+
+struct cheap *
+cheap_set_heap(struct cheap_set *set, int node)
+{
+	assert(set->magic == (u_int64_t)set);
+	assert(node >= 0 && node < set->nnodes);
+
+	return set->heapv[node];
+}
+
+void *
+cheap_set_malloc(struct cheap_set *set, size_t size)
+{
+	return cheap_malloc(cheap_set_local(set), size);
+}
+
+void *
+cheap_set_memalign(struct cheap_set *set, size_t alignment, size_t size)
+{
+	return cheap_memalign(cheap_set_local(set), alignment, size);
+}
+
+size_t
+cheap_set_used(struct cheap_set *set)
+{
+	size_t used = 0;
+	int    node;
+
+	assert(set->magic == (u_int64_t)set);
+
+	for (node = 0; node < set->nnodes; ++node)
+		used += cheap_used(set->heapv[node]);
+
+	return used;
+}
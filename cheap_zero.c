@@ -0,0 +1,145 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+/*
+ * Zeroing with non-temporal stores, for large cheap_calloc()s
+ *
+ * A plain memset() of a multi-megabyte allocation pulls every line of it
+ * through the cache, evicting whatever the caller was working on.  Above
+ * CHEAP_ZERO_NT_MIN, cheap_zero() uses streaming stores instead, with the
+ * widest vectors the CPU has (picked once, at first use).
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "cursor_heap.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+
+#define CHEAP_ZERO_X86  1
+#endif
+
+typedef void cheap_zero_fn(void *, size_t);
+
+#if CHEAP_ZERO_X86
+
+/* Each of these zeroes [p, p + len) where p is 64-byte aligned and len
+ * is a multiple of 64.  The caller fences.
+ */
+
+__attribute__((target("avx512f")))
+static void
+cheap_zero_nt_avx512(void *p, size_t len)
+{
+	__m512i zero = _mm512_setzero_si512();
+	char   *cp = p, *end = cp + len;
+
+	for (; cp < end; cp += 64)
+		_mm512_stream_si512((void *)cp, zero);
+}
+
+__attribute__((target("avx2")))
+static void
+cheap_zero_nt_avx2(void *p, size_t len)
+{
+	__m256i zero = _mm256_setzero_si256();
+	char   *cp = p, *end = cp + len;
+
+	for (; cp < end; cp += 64) {
+		_mm256_stream_si256((__m256i *)cp, zero);
+		_mm256_stream_si256((__m256i *)(cp + 32), zero);
+	}
+}
+
+/* SSE2 is baseline on x86_64, so this is the fallback */
+static void
+cheap_zero_nt_sse2(void *p, size_t len)
+{
+	__m128i zero = _mm_setzero_si128();
+	char   *cp = p, *end = cp + len;
+
+	for (; cp < end; cp += 64) {
+		_mm_stream_si128((__m128i *)cp, zero);
+		_mm_stream_si128((__m128i *)(cp + 16), zero);
+		_mm_stream_si128((__m128i *)(cp + 32), zero);
+		_mm_stream_si128((__m128i *)(cp + 48), zero);
+	}
+}
+
+#endif
+
+static void
+cheap_zero_nt_memset(void *p, size_t len)
+{
+	memset(p, 0, len);
+}
+
+static cheap_zero_fn *cheap_zero_nt_fn;
+static const char    *cheap_zero_nt_name;
+
+static void
+cheap_zero_select(void)
+{
+	cheap_zero_fn *fn = cheap_zero_nt_memset;
+	const char    *name = "memset";
+
+#if CHEAP_ZERO_X86
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx512f")) {
+		fn = cheap_zero_nt_avx512;
+		name = "avx512";
+	} else if (__builtin_cpu_supports("avx2")) {
+		fn = cheap_zero_nt_avx2;
+		name = "avx2";
+	} else {
+		fn = cheap_zero_nt_sse2;
+		name = "sse2";
+	}
+#endif
+
+	/* Racing threads all pick the same thing */
+	__atomic_store_n(&cheap_zero_nt_name, name, __ATOMIC_RELAXED);
+	__atomic_store_n(&cheap_zero_nt_fn, fn, __ATOMIC_RELEASE);
+}
+
+void
+cheap_zero_nt(void *p, size_t len)
+{
+	cheap_zero_fn *fn = __atomic_load_n(&cheap_zero_nt_fn, __ATOMIC_ACQUIRE);
+	uintptr_t      start = (uintptr_t)p;
+	uintptr_t      end = start + len;
+	uintptr_t      astart, aend;
+
+	if (!fn) {
+		cheap_zero_select();
+		fn = cheap_zero_nt_fn;
+	}
+
+	/* Regular stores for the unaligned head and tail */
+	astart = ALIGN(start, 64);
+	aend = end & ~(uintptr_t)63;
+	if (astart >= aend) {
+		memset(p, 0, len);
+		return;
+	}
+
+	memset(p, 0, astart - start);
+	fn((void *)astart, aend - astart);
+	memset((void *)aend, 0, end - aend);
+
+#if CHEAP_ZERO_X86
+	/* Streaming stores are weakly ordered */
+	_mm_sfence();
+#endif
+}
+
+const char *
+cheap_zero_isa(void)
+{
+	if (!__atomic_load_n(&cheap_zero_nt_fn, __ATOMIC_ACQUIRE))
+		cheap_zero_select();
+
+	return cheap_zero_nt_name;
+}
@@ -3,19 +3,101 @@
  * Copyright (C) 2015-2020 Micron Technology, Inc.  All rights reserved.
  */
 
+#define _GNU_SOURCE
+
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <errno.h>
+#include <pthread.h>
+#include <linux/mempolicy.h>
 
 #include "cursor_heap.h"
 #include "cheap_dax.h"
+#include "cheap_numa.h"
+#include "cheap_populate.h"
 #include "minmax.h"
 #include "assert.h"
 
+static void
+cheap_tcache_destroy(struct cheap *h);
+
+static void
+cheap_seg_unmap(struct cheap_seg *seg)
+{
+	munmap(seg->mem, seg->len);
+	free(seg);
+}
+
+/*
+ * The known-zero break: nothing at or above it has been handed out since
+ * the memory was last known to be zero, so calloc-style allocations need
+ * only zero what lies below it.  Unlike brk (which tracks what may be
+ * resident, for cheap_trim()), populating a cheap doesn't raise it.
+ * Each segment of a CHEAP_F_GROW cheap has its own.
+ */
+static inline u_int64_t *
+cheap_zbrkp(struct cheap *h, struct cheap_seg *seg)
+{
+	return seg ? &seg->zbrk : &h->zbrk;
+}
+
+static inline void
+cheap_zbrk_raise(struct cheap *h, struct cheap_seg *seg, u_int64_t addr)
+{
+	u_int64_t *zbrkp = cheap_zbrkp(h, seg);
+	u_int64_t  zbrk;
+
+	/* Ignore addresses of some other segment (a stale view) */
+	if (seg && (addr < seg->base || addr > seg->base + seg->size))
+		return;
+
+	zbrk = __atomic_load_n(zbrkp, __ATOMIC_RELAXED);
+	while (zbrk < addr &&
+	       !__atomic_compare_exchange_n(zbrkp, &zbrk, addr, 1,
+					    __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+		;
+}
+
+/*
+ * Raise the brk high-water mark to cover @end.  The prefault thread
+ * raises it concurrently, so this is an atomic max, lest a plain store
+ * lower it and cheap_trim() miss pages that were prefaulted.
+ */
+static inline void
+cheap_brk_raise(struct cheap *h, u_int64_t end)
+{
+	u_int64_t brk = __atomic_load_n(&h->brk, __ATOMIC_RELAXED);
+
+	end = PAGE_ALIGN(end);
+	while (brk < end &&
+	       !__atomic_compare_exchange_n(&h->brk, &brk, end, 1,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
+/*
+ * The sync low-water mark of a persistent cheap: the lowest the cursor
+ * has been since the last cheap_sync().  Memory handed out again after a
+ * rewind, reset or free lies below the synced cursor, so cheap_sync()
+ * must persist from here rather than from there.
+ */
+static inline void
+cheap_synclow_lower(struct cheap *h, u_int64_t cursorp)
+{
+	u_int64_t low = __atomic_load_n(&h->synclow, __ATOMIC_RELAXED);
+
+	while (cursorp < low &&
+	       !__atomic_compare_exchange_n(&h->synclow, &low, cursorp, 1,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+}
+
 static struct cheap *
 __cheap_create(void *mem, int alignment, size_t size)
 {
@@ -44,43 +126,315 @@ __cheap_create(void *mem, int alignment, size_t size)
         h->base      = ALIGN((u_int64_t)h->mem, CL_SIZE);
         h->cursorp   = h->base;
         h->brk       = PAGE_ALIGN(h->cursorp);
+        h->zbrk      = h->base;
         h->lastp     = 0;
+        h->pagesz    = PAGE_SIZE;
 
 	return h;
 }
 
-struct cheap *
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT  26
+#endif
 
-cheap_create(int alignment, size_t size)
+#ifndef MFD_HUGE_SHIFT
+#define MFD_HUGE_SHIFT  26
+#endif
+
+/* Map @size bytes of hugetlb memory with pages of (1 << @shift) bytes,
+ * either directly (MAP_HUGETLB) or through a hugetlbfs memfd.  @mtype
+ * is MAP_SHARED or MAP_PRIVATE.
+ */
+static void *
+cheap_mmap_hugetlb(size_t size, int shift, int memfd, int mtype)
+{
+	void *addr;
+	int   fd;
+
+	if (!memfd)
+		return mmap(NULL, size, PROT_READ | PROT_WRITE,
+			    mtype | MAP_ANONYMOUS | MAP_HUGETLB |
+			    (shift << MAP_HUGE_SHIFT), -1, 0);
+
+	fd = memfd_create("cheap", MFD_CLOEXEC | MFD_HUGETLB |
+			  (shift << MFD_HUGE_SHIFT));
+	if (fd < 0)
+		return MAP_FAILED;
+
+	addr = MAP_FAILED;
+	if (!ftruncate(fd, size))
+		addr = mmap(NULL, size, PROT_READ | PROT_WRITE, mtype, fd, 0);
+
+	/* The mapping keeps the file alive */
+	close(fd);
+
+	return addr;
+}
+
+/* Return the THP size if transparent huge pages can be had via
+ * MADV_HUGEPAGE, otherwise zero.
+ */
+static size_t
+cheap_thp_size(void)
+{
+	char   buf[128];
+	size_t sz = 0;
+	FILE  *fp;
+
+	fp = fopen("/sys/kernel/mm/transparent_hugepage/enabled", "r");
+	if (!fp)
+		return 0;
+
+	if (!fgets(buf, sizeof(buf), fp) || strstr(buf, "[never]")) {
+		fclose(fp);
+		return 0;
+	}
+	fclose(fp);
+
+	fp = fopen("/sys/kernel/mm/transparent_hugepage/hpage_pmd_size", "r");
+	if (fp) {
+		if (fscanf(fp, "%zu", &sz) != 1)
+			sz = 0;
+		fclose(fp);
+	}
+
+	return sz ?: CHEAP_HUGE_2M_SZ;
+}
+
+/* Map a private anonymous region aligned to @align, so that THP can
+ * back all of it with huge pages.
+ */
+static void *
+cheap_mmap_private_aligned(size_t size, size_t align)
+{
+	u_int64_t start, end;
+	void *    addr;
+
+	addr = mmap(NULL, size + align, PROT_READ | PROT_WRITE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (addr == MAP_FAILED)
+		return addr;
+
+	start = ALIGN((u_int64_t)addr, align);
+	end = (u_int64_t)addr + size + align;
+
+	if (start > (u_int64_t)addr)
+		munmap(addr, start - (u_int64_t)addr);
+	if (end > start + size)
+		munmap((void *)(start + size), end - (start + size));
+
+	return (void *)start;
+}
+
+/*
+ * cheap_mmap_anon() - map anonymous memory for a cheap (or a segment)
+ * @sizep:   in: minimum size, out: size actually mapped
+ * @flagsp:  in: CHEAP_F_* flags, out: with any huge page options that
+ *           could not be honored replaced by what was actually used
+ * @pageszp: out: size of the pages backing the mapping
+ *
+ * Explicit huge pages fall back from 1GiB to 2MiB to base pages when
+ * the kernel has no huge pages of the requested size to give.
+ *
+ * The mapping is shared (shmem) unless CHEAP_F_PRIVATE is given.
+ */
+static void *
+cheap_mmap_anon(size_t *sizep, u_int32_t *flagsp, size_t *pageszp)
+{
+	u_int32_t flags = *flagsp;
+	int       memfd = flags & CHEAP_F_HUGE_MEMFD;
+	int       mtype;
+	size_t    size;
+	void *    addr;
+
+	mtype = (flags & CHEAP_F_PRIVATE) ? MAP_PRIVATE : MAP_SHARED;
+
+	if (flags & CHEAP_F_HUGE_1G) {
+		size = ALIGN(*sizep, CHEAP_HUGE_1G_SZ);
+		addr = cheap_mmap_hugetlb(size, 30, memfd, mtype);
+		if (addr != MAP_FAILED) {
+			*pageszp = CHEAP_HUGE_1G_SZ;
+			goto out;
+		}
+
+		flags &= ~CHEAP_F_HUGE_1G;
+		flags |= CHEAP_F_HUGE_2M;
+	}
+
+	if (flags & CHEAP_F_HUGE_2M) {
+		size = ALIGN(*sizep, CHEAP_HUGE_2M_SZ);
+		addr = cheap_mmap_hugetlb(size, 21, memfd, mtype);
+		if (addr != MAP_FAILED) {
+			*pageszp = CHEAP_HUGE_2M_SZ;
+			goto out;
+		}
+
+		flags &= ~(CHEAP_F_HUGE_2M | CHEAP_F_HUGE_MEMFD);
+	}
+
+	size = ALIGN(*sizep, CHEAP_HUGE_2M_SZ);
+
+	if (flags & CHEAP_F_THP) {
+		size_t thpsz = cheap_thp_size();
+
+		addr = cheap_mmap_private_aligned(size, max_t(size_t, thpsz, PAGE_SIZE));
+		if (addr == MAP_FAILED)
+			return addr;
+
+		if (thpsz && madvise(addr, size, MADV_HUGEPAGE))
+			thpsz = 0;
+
+		*pageszp = thpsz ?: PAGE_SIZE;
+		goto out;
+	}
+
+	addr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		    mtype | MAP_ANONYMOUS, -1, 0);
+	if (addr == MAP_FAILED)
+		return addr;
+
+	*pageszp = PAGE_SIZE;
+
+out:
+	if (((flags & CHEAP_F_DONTFORK) && madvise(addr, size, MADV_DONTFORK)) ||
+	    ((flags & CHEAP_F_WIPEONFORK) && madvise(addr, size, MADV_WIPEONFORK))) {
+		munmap(addr, size);
+		return MAP_FAILED;
+	}
+
+	*sizep = size;
+	*flagsp = flags;
+
+	return addr;
+}
+
+struct cheap *
+cheap_create_flags(int alignment, size_t size, u_int32_t flags)
 {
 	struct cheap *h;
+	size_t pagesz;
 	void *addr;
 
 	if (size < 0)
 		return NULL;
 
+	if (flags & ~CHEAP_F_MASK)
+		return NULL;
+
+	/* At most one page size, and THP is not hugetlb */
+	if ((flags & CHEAP_F_HUGE_2M) && (flags & CHEAP_F_HUGE_1G))
+		return NULL;
+	if ((flags & CHEAP_F_THP) && (flags & CHEAP_F_HUGE_MASK))
+		return NULL;
+	if ((flags & CHEAP_F_HUGE_MEMFD) &&
+	    !(flags & (CHEAP_F_HUGE_2M | CHEAP_F_HUGE_1G)))
+		return NULL;
+
+	/* THP only applies to private mappings */
+	if (flags & CHEAP_F_THP)
+		flags |= CHEAP_F_PRIVATE;
+
+	/* The kernel only wipes private, non-hugetlb anonymous memory */
+	if ((flags & CHEAP_F_WIPEONFORK) &&
+	    (!(flags & CHEAP_F_PRIVATE) || (flags & CHEAP_F_HUGE_MASK)))
+		return NULL;
+	if ((flags & CHEAP_F_WIPEONFORK) && (flags & CHEAP_F_DONTFORK))
+		return NULL;
+
 	/* Align the size of all cheaps to an integral multiple
 	 * of 2MB in hopes of making life easier on the VMM.
+	 * (Mappings backed by 1GB pages are rounded up to 1GB.)
 	 */
 	size = ALIGN(size, 2u << 20);
 
 	/* get memory via anonymous mmap */
-	addr = mmap(NULL, size, PROT_READ | PROT_WRITE,
-		    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	addr = cheap_mmap_anon(&size, &flags, &pagesz);
 	if (addr == MAP_FAILED) {
 		fprintf(stderr, "Anonymous mmap failed\n");
 		exit(-1);
 	}
 	h = __cheap_create(addr, alignment, size);
-	if (h)
-		h->mapped = 1;
+	if (!h) {
+		munmap(addr, size);
+		return NULL;
+	}
+
+	h->mapped = 1;
+	h->flags = flags;
+	h->pagesz = pagesz;
+
+	if (flags & CHEAP_F_GROW) {
+		h->seg = calloc(1, sizeof(*h->seg));
+		if (!h->seg) {
+			cheap_destroy(h);
+			return NULL;
+		}
+
+		h->seg->mem  = h->mem;
+		h->seg->len  = h->size;
+		h->seg->base = h->base;
+		h->seg->size = h->size;
+		h->seg->zbrk = h->zbrk;
+		h->seg->pagesz = h->pagesz;
+		pthread_mutex_init(&h->seg_lock, NULL);
+	}
+
+	if ((flags & CHEAP_F_POPULATE) && cheap_populate(h, 0, 0)) {
+		cheap_destroy(h);
+		return NULL;
+	}
+
 	return h;
 }
 
+struct cheap *
+cheap_create(int alignment, size_t size)
+{
+	return cheap_create_flags(alignment, size, 0);
+}
+
+struct cheap *
+cheap_create_mt(int alignment, size_t size)
+{
+	return cheap_create_flags(alignment, size, CHEAP_F_MT);
+}
+
+#ifndef MAP_SHARED_VALIDATE
+#define MAP_SHARED_VALIDATE     0x03
+#endif
+
+#ifndef MAP_SYNC
+#define MAP_SYNC                0x80000
+#endif
+
+/* Map @len bytes of @mfd at @offset, synchronously (so that cache flushes
+ * alone make stores durable, see cheap_persist()) if the file supports it.
+ * If @fixed is not NULL, the mapping replaces whatever is there.
+ */
+static void *
+cheap_dax_mmap(void *fixed, int mfd, off_t offset, size_t len, int *mapsyncp)
+{
+	int mflags = fixed ? MAP_FIXED : 0;
+	void *addr;
+
+	addr = mmap(fixed, len, PROT_READ | PROT_WRITE,
+		    MAP_SHARED_VALIDATE | MAP_SYNC | mflags, mfd, offset);
+	if (addr != MAP_FAILED) {
+		*mapsyncp = 1;
+		return addr;
+	}
+
+	/* Not DAX (or a kernel before 4.15) */
+	*mapsyncp = 0;
+
+	return mmap(fixed, len, PROT_READ | PROT_WRITE, MAP_SHARED | mflags,
+		    mfd, offset);
+}
+
 struct cheap *
 cheap_create_dax(const char *devpath, int alignment)
 {
-	int mfd;
+	int mfd, mapsync;
 	void *addr;
 	size_t size;
 	struct cheap *h;
@@ -105,8 +459,7 @@ cheap_create_dax(const char *devpath, int alignment)
 		exit(-1);
 	}
 
-	addr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED,
-		    mfd, 0);
+	addr = cheap_dax_mmap(NULL, mfd, 0, size, &mapsync);
 	if (addr == MAP_FAILED) {
 		fprintf(stderr, "mmap failed for device %s\n", devpath);
 		exit(-1);
@@ -115,116 +468,1608 @@ cheap_create_dax(const char *devpath, int alignment)
 	if (h) {
 		h->mfd = mfd;
 		h->mapped = 1;
+		h->mapsync = mapsync;
+		h->zbrk = h->base + size;  /* Never known to be zero */
 	}
 	return h;
 }
 
-void
-cheap_destroy(struct cheap *h)
+/* Map [offset, offset + *lenp) of @path (to the end of it if *lenp is 0),
+ * checking that the range is mappable as given.  On success, returns the
+ * mapping and sets *lenp, *alignp (the device's mapping granularity),
+ * *mfdp and *mapsyncp.  Otherwise returns NULL with errno set.
+ */
+static void *
+cheap_dax_map(const char *path, off_t offset, size_t *lenp, size_t *alignp,
+	      int *mfdp, int *mapsyncp)
 {
-    if (!h)
-        return;
-
-    assert(h->magic == (u_int64_t)h);
-
-    if (h->mapped)
-	    munmap((void *)h->mem, h->size);
+	size_t size, align, len = *lenp;
+	void *addr;
+	int mfd;
+	int rc;
 
-    if (h->mfd)
-	    close(h->mfd);
+	rc = cheap_devdax_get_file_size(path, &size);
+	if (!rc)
+		rc = cheap_devdax_get_align(path, &align);
+	if (rc) {
+		errno = -rc;
+		return NULL;
+	}
 
-    h->magic = ~h->magic;
-}
+	if (offset < 0 || (size_t)offset >= size)
+		goto einval;
 
-static inline void *
-cheap_memalign_impl(struct cheap *h, int alignment, size_t size)
-{
-    u_int64_t allocp;
+	if (offset % align)
+		goto einval;
 
-    assert(h->magic == (u_int64_t)h);
+	/* To the end is to the last whole unit, so a file needn't be sized
+	 * in multiples of the alignment.  A range given explicitly must be
+	 * mappable exactly as given.
+	 */
+	if (!len) {
+		len = (size - offset) / align * align;
+		if (!len)
+			goto einval;
+	}
 
-    assert(1 == __builtin_popcount(alignment));
+	if (len % align || len > size - offset)
+		goto einval;
 
-    allocp = ALIGN(h->cursorp, alignment);
+	mfd = open(path, O_RDWR);
+	if (mfd < 0)
+		return NULL;
 
-    if (size > h->size)
-        return NULL;
+	addr = cheap_dax_mmap(NULL, mfd, offset, len, mapsyncp);
+	if (addr == MAP_FAILED) {
+		rc = errno;
+		close(mfd);
+		errno = rc;
+		return NULL;
+	}
 
-    if ((allocp - h->base + size) > h->size)
-        return NULL;
+	*lenp = len;
+	*alignp = align;
+	*mfdp = mfd;
 
-    h->cursorp = allocp + size;
-    h->lastp = allocp;
+	return addr;
 
-    return (void *)allocp;
+einval:
+	errno = EINVAL;
+	return NULL;
 }
 
-void *
-cheap_memalign(struct cheap *h, int alignment, size_t size)
+struct cheap *
+cheap_create_dax_range(const char *path, off_t offset, size_t len,
+		       int alignment)
 {
-	if (alignment & (alignment - 1))
+	struct cheap *h;
+	size_t align;
+	void *addr;
+	int mfd, mapsync;
+
+	addr = cheap_dax_map(path, offset, &len, &align, &mfd, &mapsync);
+	if (!addr)
 		return NULL;
 
-	return cheap_memalign_impl(h, alignment, size);
+	h = __cheap_create(addr, alignment, len);
+	if (!h) {
+		munmap(addr, len);
+		close(mfd);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	h->mfd = mfd;
+	h->mapped = 1;
+	h->mapsync = mapsync;
+	h->zbrk = h->base + len;  /* Never known to be zero */
+
+	return h;
 }
 
-void *
-cheap_memalign_zero(struct cheap *h, int alignment, size_t size)
+static struct cheap *
+cheap_create_dax_multi_impl(const char **paths, int n, size_t stripe,
+			    int alignment)
 {
-	void *p;
+	struct cheap_dax_dev *devv;
+	size_t total = 0, align = PAGE_SIZE, minsz = SIZE_MAX;
+	size_t off, len;
+	int mapsync = 1, devsync;
+	int i;
+	struct cheap *h = NULL;
+	char *resv = MAP_FAILED, *mem, *addr;
+	int rc = 0;
 
-	if (alignment & (alignment - 1))
+	if (n < 1 || (stripe & (PAGE_SIZE - 1))) {
+		errno = EINVAL;
 		return NULL;
+	}
 
-	p = cheap_memalign_impl(h, alignment, size);
-	memset(p, 0, size);
-	return p;
+	devv = calloc(n, sizeof(*devv));
+	if (!devv)
+		return NULL;
+
+	for (i = 0; i < n; ++i)
+		devv[i].fd = -1;
+
+	for (i = 0; i < n; ++i) {
+		rc = cheap_devdax_get_file_size(paths[i], &devv[i].size);
+		if (!rc)
+			rc = cheap_devdax_get_align(paths[i], &devv[i].align);
+		if (rc)
+			goto errout;
+
+		/* Stripes must be whole units of every device */
+		if (stripe % devv[i].align) {
+			rc = -EINVAL;
+			goto errout;
+		}
+
+		/* A partial unit at the end of a device can't be mapped */
+		devv[i].size -= devv[i].size % devv[i].align;
+		if (!devv[i].size) {
+			rc = -EINVAL;
+			goto errout;
+		}
+
+		devv[i].fd = open(paths[i], O_RDWR);
+		if (devv[i].fd < 0) {
+			rc = -errno;
+			goto errout;
+		}
+
+		align = max_t(size_t, align, devv[i].align);
+		minsz = min_t(size_t, minsz, devv[i].size);
+	}
+
+	if (stripe) {
+		/* Striping uses the same amount of every device */
+		minsz -= minsz % stripe;
+		if (!minsz) {
+			rc = -EINVAL;
+			goto errout;
+		}
+		total = minsz * n;
+	} else {
+		rc = cheap_dax_concat(devv, n, &total);
+		if (rc)
+			goto errout;
+	}
+
+	/* Reserve the whole range up front, aligned to the largest device
+	 * alignment.  Every mapping then lands on a multiple of its own
+	 * device's alignment: stripes are whole units of every device, and
+	 * cheap_dax_concat() rejects a device that would start part way
+	 * through one of its units.
+	 */
+	resv = mmap(NULL, total + align, PROT_NONE,
+		    MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (resv == MAP_FAILED) {
+		rc = -errno;
+		goto errout;
+	}
+
+	mem = (char *)ALIGN((u_int64_t)resv, align);
+	if (mem > resv)
+		munmap(resv, mem - resv);
+	munmap(mem + total, resv + align - mem);
+	resv = mem;
+
+	for (off = 0, i = 0; off < total; off += len, i = (i + 1) % n) {
+		struct cheap_dax_dev *dev = &devv[i];
+		off_t devoff = stripe ? (off / (stripe * n)) * stripe : 0;
+
+		assert(stripe || off == dev->off);
+		len = stripe ?: dev->size;
+
+		addr = cheap_dax_mmap(mem + off, dev->fd, devoff, len, &devsync);
+		if (addr == MAP_FAILED) {
+			rc = -errno;
+			goto errout;
+		}
+
+		mapsync &= devsync;
+	}
+
+	h = __cheap_create(mem, alignment, total);
+	if (!h) {
+		rc = -EINVAL;
+		goto errout;
+	}
+
+	/* The mappings hold their own references to the devices, so just
+	 * one fd is kept (it marks the cheap as device backed).
+	 */
+	h->mfd = devv[0].fd;
+	devv[0].fd = -1;
+	h->mapped = 1;
+	h->mapsync = mapsync;
+	h->zbrk = h->base + total;  /* Never known to be zero */
+
+errout:
+	if (rc && resv != MAP_FAILED)
+		munmap(resv, total);
+
+	for (i = 0; i < n; ++i) {
+		if (devv[i].fd >= 0)
+			close(devv[i].fd);
+	}
+	free(devv);
+
+	if (rc)
+		errno = -rc;
+
+	return h;
 }
 
-void *
-cheap_malloc(struct cheap *h, size_t size)
+struct cheap *
+cheap_create_dax_multi(const char **paths, int n, int alignment)
 {
-	return cheap_memalign_impl(h, h->alignment, size);
+	return cheap_create_dax_multi_impl(paths, n, 0, alignment);
 }
 
-void *
-cheap_xmalloc(struct cheap *h, size_t size)
+struct cheap *
+cheap_create_dax_striped(const char **paths, int n, size_t stripe,
+			 int alignment)
 {
-	void *mem = cheap_malloc(h, size);
-
-	if (mem == NULL)
-		exit(-1);
+	if (!stripe) {
+		errno = EINVAL;
+		return NULL;
+	}
 
-	return mem;
+	return cheap_create_dax_multi_impl(paths, n, stripe, alignment);
 }
 
-void
-cheap_free(struct cheap *h, void *addr)
+/* Attach a cheap to the persistent heap whose header is at @hdr.  The
+ * header takes the first hdr->base bytes of the mapping, so the cheap
+ * proper (h->mem through h->mem + h->size) starts after it.
+ */
+static struct cheap *
+cheap_dax_attach(struct cheap_dax_hdr *hdr, int mfd, int mapsync)
 {
-    /* Freeing within a cheap can only occur if the user of the cheap only
-     * ever frees something that was just allocated. Once another thing has
-     * been allocated, we can't free the previously allocated thing. The
-     * use case for the free is to handle the case where the owner of the
-     * cheap needs to allocate space to ensure that it can make progress
-     * after it does something that may fail. If the failure occurs, we want
-     * to free the just-allocated space.
-     *
-     * [HSE_REVISIT] - this should be replaced by a reservation mechanism
-     */
-    if (h->lastp && (u_int64_t)addr == h->lastp) {
-        if (h->brk < h->cursorp)
-            h->brk = PAGE_ALIGN(h->cursorp);
-        h->cursorp = h->lastp;
-        h->lastp = 0;
-    }
-}
+	struct cheap *h;
 
-size_t
-cheap_used(struct cheap *h)
-{
-    assert(h->magic == (u_int64_t)h);
+	h = __cheap_create((char *)hdr + hdr->base, hdr->alignment,
+			   hdr->size - hdr->base);
+	if (!h) {
+		errno = EINVAL;
+		return NULL;
+	}
 
-    return min_t(size_t, h->size, (h->cursorp - h->base));
+	h->mfd = mfd;
+	h->mapped = 1;
+	h->mapsync = mapsync;
+	h->hdr = hdr;
+	h->cursorp = (u_int64_t)hdr + hdr->cursor;
+	h->synclow = h->cursorp;
+	h->brk = PAGE_ALIGN(h->cursorp);
+	h->zbrk = h->base + h->size;  /* Never known to be zero */
+
+	return h;
+}
+
+struct cheap *
+cheap_format_dax(const char *path, int alignment)
+{
+	struct cheap_dax_hdr *hdr;
+	struct cheap *h;
+	size_t len = 0, align;
+	int mfd, mapsync;
+	int rc;
+
+	if (alignment < 1 || alignment > 64 || (alignment & (alignment - 1))) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	hdr = cheap_dax_map(path, 0, &len, &align, &mfd, &mapsync);
+	if (!hdr)
+		return NULL;
+
+	/* Keep the heap aligned to the device's page size */
+	if (len < 2 * align) {
+		munmap(hdr, len);
+		close(mfd);
+		errno = EINVAL;
+		return NULL;
+	}
+
+	/* Invalidate any previous heap before rewriting the header, and
+	 * validate it only once the rest is durable.  On a MAP_SYNC mapping
+	 * msync() doesn't write back the CPU caches, so each step goes
+	 * through cheap_dax_persist().
+	 */
+	hdr->magic = 0;
+	rc = cheap_dax_persist(hdr, sizeof(*hdr), mapsync);
+
+	if (!rc) {
+		hdr->version = CHEAP_DAX_VERSION;
+		hdr->alignment = alignment;
+		hdr->size = len;
+		hdr->base = align;
+		hdr->cursor = align;
+		rc = cheap_dax_persist(hdr, sizeof(*hdr), mapsync);
+	}
+
+	if (!rc) {
+		hdr->magic = CHEAP_DAX_MAGIC;
+		rc = cheap_dax_persist(hdr, sizeof(*hdr), mapsync);
+	}
+
+	if (rc) {
+		munmap(hdr, len);
+		close(mfd);
+		errno = -rc;
+		return NULL;
+	}
+
+	h = cheap_dax_attach(hdr, mfd, mapsync);
+	if (!h) {
+		munmap(hdr, len);
+		close(mfd);
+	}
+
+	return h;
+}
+
+struct cheap *
+cheap_open_dax(const char *path)
+{
+	struct cheap_dax_hdr ohdr, *hdr;
+	struct cheap *h;
+	size_t len, align;
+	int mfd, mapsync;
+	int rc;
+
+	/* Read the header through a mapping of the first unit, not pread():
+	 * devdax character devices don't implement read(2).
+	 */
+	rc = cheap_devdax_get_align(path, &align);
+	if (rc) {
+		errno = -rc;
+		return NULL;
+	}
+
+	len = align;
+	hdr = cheap_dax_map(path, 0, &len, &align, &mfd, &mapsync);
+	if (!hdr)
+		return NULL;
+
+	ohdr = *hdr;
+	munmap(hdr, len);
+	close(mfd);
+
+	if (ohdr.magic != CHEAP_DAX_MAGIC ||
+	    ohdr.version != CHEAP_DAX_VERSION) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (ohdr.base < sizeof(ohdr) || ohdr.base >= ohdr.size ||
+	    ohdr.cursor < ohdr.base || ohdr.cursor > ohdr.size) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	/* Map exactly the heap, even if the file has since grown */
+	len = ohdr.size;
+	hdr = cheap_dax_map(path, 0, &len, &align, &mfd, &mapsync);
+	if (!hdr)
+		return NULL;
+
+	h = cheap_dax_attach(hdr, mfd, mapsync);
+	if (!h) {
+		munmap(hdr, len);
+		close(mfd);
+	}
+
+	return h;
+}
+
+int
+cheap_sync(struct cheap *h)
+{
+	struct cheap_dax_hdr *hdr = h->hdr;
+	u_int64_t synced, cursor;
+	int rc;
+
+	assert(h->magic == (u_int64_t)h);
+
+	if (!hdr)
+		return -EINVAL;
+
+	/* Anything handed out below the synced cursor since the last sync
+	 * (after a rewind, reset or free) must be persisted too.
+	 */
+	synced = (u_int64_t)hdr + hdr->cursor;
+	synced = min_t(u_int64_t, synced,
+		       __atomic_load_n(&h->synclow, __ATOMIC_RELAXED));
+	cursor = __atomic_load_n(&h->cursorp, __ATOMIC_RELAXED);
+
+	/* What the new cursor covers must be durable first ... */
+	if (cursor > synced) {
+		rc = cheap_persist(h, (void *)synced, cursor - synced);
+		if (rc)
+			return rc;
+	}
+
+	/* ... then the cursor itself, in a single 8-byte store, so a crash
+	 * leaves either the old or the new one.
+	 */
+	__atomic_store_n(&hdr->cursor, cursor - (u_int64_t)hdr,
+			 __ATOMIC_RELEASE);
+
+	rc = cheap_persist(h, &hdr->cursor, sizeof(hdr->cursor));
+	if (!rc)
+		__atomic_store_n(&h->synclow, cursor, __ATOMIC_RELAXED);
+
+	return rc;
+}
+
+struct cheap *
+cheap_create_numa(int alignment, size_t size,
+		  const struct cheap_numa_policy *policy)
+{
+	u_int64_t nodes = policy->nodemask;
+	struct cheap *h;
+	int mpol;
+	int rc;
+
+	switch (policy->mode) {
+	case CHEAP_NUMA_BIND:
+		mpol = MPOL_BIND;
+		break;
+	case CHEAP_NUMA_PREFERRED:
+		mpol = MPOL_PREFERRED;
+		if (nodes & (nodes - 1))
+			goto einval;
+		break;
+	case CHEAP_NUMA_INTERLEAVE:
+		mpol = MPOL_INTERLEAVE;
+		break;
+	default:
+		goto einval;
+	}
+
+	if (!nodes)
+		goto einval;
+
+	/* Populate only after the policy is in place */
+	h = cheap_create_flags(alignment, size,
+			       policy->flags & ~CHEAP_F_POPULATE);
+	if (!h)
+		goto einval;
+
+	/* Nothing has touched the cheap yet, so the policy covers it all */
+	rc = cheap_numa_mbind(h->mem, h->size, mpol, nodes);
+	if (rc) {
+		cheap_destroy(h);
+		errno = -rc;
+		return NULL;
+	}
+
+	h->numa_mpol = mpol;
+	h->numa_nodes = nodes;
+
+	if (policy->flags & CHEAP_F_POPULATE) {
+		h->flags |= CHEAP_F_POPULATE;
+
+		rc = cheap_populate(h, 0, 0);
+		if (rc) {
+			cheap_destroy(h);
+			errno = -rc;
+			return NULL;
+		}
+	}
+
+	return h;
+
+einval:
+	errno = EINVAL;
+	return NULL;
+}
+
+ssize_t
+cheap_numa_stat(struct cheap *h, size_t *bytesv, int nnodes)
+{
+	struct cheap_seg *seg;
+	ssize_t total, n;
+	size_t pagesz;
+
+	assert(h->magic == (u_int64_t)h);
+
+	memset(bytesv, 0, nnodes * sizeof(*bytesv));
+
+	/* THP may back any part of a cheap with base pages */
+	pagesz = (h->flags & CHEAP_F_THP) ? PAGE_SIZE : h->pagesz;
+
+	if (!h->seg)
+		return cheap_numa_residency(h->mem, h->size, pagesz,
+					    bytesv, nnodes);
+
+	total = 0;
+	for (seg = h->seg; seg; seg = seg->next) {
+		if (!(h->flags & CHEAP_F_THP))
+			pagesz = seg->pagesz;
+
+		n = cheap_numa_residency(seg->mem, seg->len, pagesz,
+					 bytesv, nnodes);
+		if (n < 0)
+			return n;
+		total += n;
+	}
+
+	return total;
+}
+
+void
+cheap_destroy(struct cheap *h)
+{
+    if (!h)
+        return;
+
+    assert(h->magic == (u_int64_t)h);
+
+    if (h->prefault)
+        cheap_prefault_stop(h);
+
+    if (h->tcpool)
+        cheap_tcache_destroy(h);
+
+    if (h->seg) {
+        struct cheap_seg *seg;
+
+        if (h->spare)
+            cheap_seg_unmap(h->spare);
+
+        while ((seg = h->seg)) {
+            h->seg = seg->next;
+            cheap_seg_unmap(seg);
+        }
+        pthread_mutex_destroy(&h->seg_lock);
+    } else if (h->hdr) {
+	    size_t len = h->hdr->size;
+
+	    cheap_sync(h);
+	    munmap(h->hdr, len);
+    } else if (h->mapped) {
+	    munmap((void *)h->mem, h->size);
+    }
+
+    if (h->mfd)
+	    close(h->mfd);
+
+    h->magic = ~h->magic;
+}
+
+/*
+ * cheap_grow() - link a new segment into a CHEAP_F_GROW cheap
+ * @h:      the cheap
+ * @seg:    the segment the caller found to be full
+ * @size:   size of the allocation that did not fit
+ * @align:  alignment of the allocation that did not fit
+ *
+ * Each new segment is at least twice the size of the one it replaces.
+ * Only the current segment (h->seg, mirrored in h->base and h->size) is
+ * ever allocated from, so the allocation fast path is exactly that of a
+ * single segment cheap; this runs only when the current segment is full.
+ * Retired segments stay mapped until cheap_destroy().
+ *
+ * Return: 0 if @h has a current segment other than @seg (the caller
+ * should retry), otherwise -ENOMEM.
+ */
+static int
+cheap_grow(struct cheap *h, struct cheap_seg *seg, size_t size, size_t align)
+{
+    struct cheap_seg *nseg;
+    u_int64_t         oldp;
+    u_int32_t         flags;
+    size_t            need, len, pagesz;
+    void *            mem;
+
+    /* Room for the request wherever the aligned cursor lands */
+    need = size + align + CL_SIZE;
+    if (need < size)
+        return -ENOMEM;
+
+    pthread_mutex_lock(&h->seg_lock);
+    if (h->seg != seg) {
+        pthread_mutex_unlock(&h->seg_lock);
+        return 0;
+    }
+
+    /* Reuse the segment most recently given up by cheap_rewind(), so
+     * that a mark/rewind loop doesn't mmap and munmap every time around.
+     */
+    nseg = h->spare;
+    if (nseg && nseg->size >= need) {
+        h->spare = NULL;
+    } else {
+        len = max_t(size_t, seg->size * 2, ALIGN(need, 2ul << 20));
+        if (len < need)
+            goto nomem;
+
+        nseg = calloc(1, sizeof(*nseg));
+        if (!nseg)
+            goto nomem;
+
+        flags = h->flags;
+        mem = cheap_mmap_anon(&len, &flags, &pagesz);
+        if (mem == MAP_FAILED) {
+            free(nseg);
+            goto nomem;
+        }
+
+        if (h->numa_mpol &&
+            cheap_numa_mbind(mem, len, h->numa_mpol, h->numa_nodes)) {
+            munmap(mem, len);
+            free(nseg);
+            goto nomem;
+        }
+
+        if ((flags & CHEAP_F_POPULATE) && cheap_populate_mem(h, mem, len, 0)) {
+            munmap(mem, len);
+            free(nseg);
+            goto nomem;
+        }
+
+        nseg->mem  = mem;
+        nseg->len  = len;
+        nseg->base = ALIGN((u_int64_t)mem, CL_SIZE);
+        nseg->size = len;
+        nseg->brk  = PAGE_ALIGN(nseg->base);
+        nseg->zbrk = nseg->base;
+        nseg->pagesz = pagesz;
+        if (flags & CHEAP_F_POPULATE)
+            nseg->brk = (u_int64_t)mem + len;
+    }
+
+    nseg->next = seg;
+
+    /* Every allocation from the old segment either completed before
+     * this exchange or will see the new cursor and fail its bounds check
+     * (the segments are disjoint), so this captures exactly how much of
+     * the old segment was used.
+     */
+    oldp = __atomic_exchange_n(&h->cursorp, nseg->base, __ATOMIC_RELAXED);
+    seg->used = min_t(size_t, seg->size, oldp - seg->base);
+    seg->brk  = max_t(u_int64_t, h->brk, PAGE_ALIGN(seg->base + seg->used));
+    cheap_zbrk_raise(h, seg, seg->base + seg->used);
+
+    h->retired += seg->used;
+    h->mem      = nseg->mem;
+    h->base     = nseg->base;
+    h->size     = nseg->size;
+    h->brk      = nseg->brk;
+    h->pagesz   = nseg->pagesz;
+    h->lastp    = 0;
+
+    __atomic_store_n(&h->seg, nseg, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&h->seg_lock);
+
+    return 0;
+
+nomem:
+    pthread_mutex_unlock(&h->seg_lock);
+
+    return -ENOMEM;
+}
+
+/*
+ * cheap_memalign_atomic() - advance the shared cursor of an MT cheap
+ *
+ * The cursor of an MT cheap is always aligned to h->alignment, because
+ * every allocation size is rounded up to it.  Requests that need no more
+ * than the default alignment therefore take a single fetch-add, while
+ * stricter alignments fall back to a cmpxchg loop.
+ *
+ * @sz must already be rounded up to h->alignment.
+ */
+static inline void *
+cheap_memalign_atomic(struct cheap *h, size_t alignment, size_t sz)
+{
+    struct cheap_seg *seg = NULL;
+    u_int64_t         base = h->base;
+    size_t            size = h->size;
+    u_int64_t         oldp, allocp;
+
+    if (h->flags & CHEAP_F_GROW) {
+retry:
+        seg = __atomic_load_n(&h->seg, __ATOMIC_ACQUIRE);
+        base = seg->base;
+        size = seg->size;
+    }
+
+    if (sz > size)
+        goto full;
+
+    if (alignment <= h->alignment) {
+        oldp = __atomic_fetch_add(&h->cursorp, sz, __ATOMIC_RELAXED);
+        if (oldp >= base && (oldp - base + sz) <= size)
+            return (void *)oldp;
+
+        /* We overshot the end of the cheap.  Give the space back
+         * unless another thread has moved the cursor since, in which
+         * case the tail is lost (but nothing larger than sz would
+         * have fit in it anyway).
+         */
+        allocp = oldp + sz;
+        __atomic_compare_exchange_n(&h->cursorp, &allocp, oldp, 0,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        goto full;
+    }
+
+    oldp = __atomic_load_n(&h->cursorp, __ATOMIC_RELAXED);
+    do {
+        allocp = ALIGN(oldp, alignment);
+        if (allocp < base || (allocp - base + sz) > size)
+            goto full;
+    } while (!__atomic_compare_exchange_n(&h->cursorp, &oldp, allocp + sz, 1,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    return (void *)allocp;
+
+full:
+    if (seg && !cheap_grow(h, seg, sz, alignment))
+        goto retry;
+
+    return NULL;
+}
+
+/*
+ * Per-thread chunk caches
+ *
+ * Each thread that allocates from a cheap with a tcache pool carves a
+ * chunk of pool->chunksz bytes off the shared cursor and then allocates
+ * from it privately, so the cache line holding the shared cursor is only
+ * touched once per chunk.  The unused tail of a thread's chunk is handed
+ * back to the cheap when the thread exits (if nothing has been allocated
+ * from the cheap after it), and all per-thread state is released when the
+ * cheap is destroyed.
+ */
+struct cheap_tcache {
+    struct cheap_tcache *next;
+    struct cheap *       h;
+    u_int64_t            cursorp;
+    u_int64_t            limit;
+};
+
+struct cheap_tcpool {
+    u_int64_t            id;
+    size_t               chunksz;
+    pthread_key_t        key;
+    pthread_mutex_t      lock;
+    struct cheap_tcache *list;
+};
+
+/* Most threads allocate from one cheap at a time, so remember the
+ * last tcache used by this thread to avoid pthread_getspecific().
+ * The pool id guards against a pool being freed and a new one
+ * allocated at the same address.
+ */
+static __thread struct {
+    struct cheap_tcpool *pool;
+    u_int64_t            id;
+    struct cheap_tcache *tc;
+} cheap_tc_last;
+
+static u_int64_t cheap_tcpool_id;
+
+/* Give back the unused tail of a thread's chunk if it is still at the
+ * end of the cheap, and leave the tcache empty.
+ */
+static void
+cheap_tcache_release(struct cheap_tcache *tc)
+{
+    u_int64_t limit = tc->limit;
+
+    __atomic_compare_exchange_n(&tc->h->cursorp, &limit, tc->cursorp, 0,
+                                __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&tc->cursorp, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&tc->limit, 0, __ATOMIC_RELAXED);
+}
+
+/* Called at thread exit, for each cheap the thread allocated from. */
+static void
+cheap_tcache_dtor(void *arg)
+{
+    struct cheap_tcache * tc = arg;
+    struct cheap_tcpool * pool = tc->h->tcpool;
+    struct cheap_tcache **pp;
+
+    pthread_mutex_lock(&pool->lock);
+    for (pp = &pool->list; *pp; pp = &(*pp)->next) {
+        if (*pp == tc) {
+            *pp = tc->next;
+            break;
+        }
+    }
+    cheap_tcache_release(tc);
+    pthread_mutex_unlock(&pool->lock);
+
+    free(tc);
+}
+
+static struct cheap_tcache *
+cheap_tcache_get(struct cheap *h)
+{
+    struct cheap_tcpool *pool = h->tcpool;
+    struct cheap_tcache *tc;
+
+    tc = pthread_getspecific(pool->key);
+    if (!tc) {
+        tc = calloc(1, sizeof(*tc));
+        if (!tc)
+            return NULL;
+
+        tc->h = h;
+
+        if (pthread_setspecific(pool->key, tc)) {
+            free(tc);
+            return NULL;
+        }
+
+        pthread_mutex_lock(&pool->lock);
+        tc->next = pool->list;
+        pool->list = tc;
+        pthread_mutex_unlock(&pool->lock);
+    }
+
+    cheap_tc_last.pool = pool;
+    cheap_tc_last.id = pool->id;
+    cheap_tc_last.tc = tc;
+
+    return tc;
+}
+
+/* Refill the calling thread's chunk and allocate from it.  Requests too
+ * large to be worth caching go straight to the shared cursor.
+ */
+static void *
+cheap_tcache_refill(struct cheap *h, struct cheap_tcache *tc, size_t alignment, size_t sz)
+{
+    size_t    chunksz = h->tcpool->chunksz;
+    u_int64_t oldp, allocp;
+
+    if (!tc || sz + alignment > chunksz / 4)
+        return cheap_memalign_atomic(h, alignment, sz);
+
+    /* If our chunk is still at the end of the cheap, extend it in place
+     * rather than abandoning its tail.
+     */
+    oldp = tc->limit;
+    if (oldp && (oldp - h->base + chunksz) <= h->size &&
+        __atomic_compare_exchange_n(&h->cursorp, &oldp, oldp + chunksz, 0,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        __atomic_store_n(&tc->limit, tc->limit + chunksz, __ATOMIC_RELAXED);
+    } else {
+        allocp = (u_int64_t)cheap_memalign_atomic(h, CL_SIZE, chunksz);
+        if (!allocp)
+            return cheap_memalign_atomic(h, alignment, sz);
+
+        /* The tail of the old chunk (if any) remains counted as used. */
+        __atomic_store_n(&tc->limit, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&tc->cursorp, allocp, __ATOMIC_RELAXED);
+        __atomic_store_n(&tc->limit, allocp + chunksz, __ATOMIC_RELAXED);
+    }
+
+    allocp = ALIGN(tc->cursorp, alignment);
+    __atomic_store_n(&tc->cursorp, allocp + sz, __ATOMIC_RELAXED);
+
+    return (void *)allocp;
+}
+
+static inline struct cheap_tcache *
+cheap_tcache_lookup(struct cheap *h)
+{
+    struct cheap_tcpool *pool = h->tcpool;
+
+    if (cheap_tc_last.pool == pool && cheap_tc_last.id == pool->id)
+        return cheap_tc_last.tc;
+
+    return cheap_tcache_get(h);
+}
+
+static inline void *
+cheap_tcache_alloc(struct cheap *h, size_t alignment, size_t sz)
+{
+    struct cheap_tcache *tc;
+    u_int64_t            allocp;
+
+    tc = cheap_tcache_lookup(h);
+    if (tc) {
+        allocp = ALIGN(tc->cursorp, alignment);
+        if (allocp + sz <= tc->limit) {
+            __atomic_store_n(&tc->cursorp, allocp + sz, __ATOMIC_RELAXED);
+            return (void *)allocp;
+        }
+    }
+
+    return cheap_tcache_refill(h, tc, alignment, sz);
+}
+
+/*
+ * cheap_memalign_mt() - allocate from a cheap shared by many threads
+ */
+static inline void *
+cheap_memalign_mt(struct cheap *h, size_t alignment, size_t size)
+{
+    size_t sz;
+
+    sz = ALIGN(size, h->alignment);
+    if (sz < size)
+        return NULL;
+
+    if (h->tcpool)
+        return cheap_tcache_alloc(h, alignment, sz);
+
+    return cheap_memalign_atomic(h, alignment, sz);
+}
+
+int
+cheap_tcache_enable(struct cheap *h, size_t chunksz)
+{
+    struct cheap_tcpool *pool;
+
+    assert(h->magic == (u_int64_t)h);
+
+    if (!(h->flags & CHEAP_F_MT) || h->tcpool)
+        return -EINVAL;
+
+    if (!chunksz)
+        chunksz = CHEAP_TCACHE_CHUNKSZ;
+
+    chunksz = ALIGN(chunksz, CL_SIZE);
+    if (chunksz > h->size)
+        return -EINVAL;
+
+    pool = calloc(1, sizeof(*pool));
+    if (!pool)
+        return -ENOMEM;
+
+    if (pthread_key_create(&pool->key, cheap_tcache_dtor)) {
+        free(pool);
+        return -ENOMEM;
+    }
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pool->chunksz = chunksz;
+    pool->id = __atomic_add_fetch(&cheap_tcpool_id, 1, __ATOMIC_RELAXED);
+
+    h->tcpool = pool;
+
+    return 0;
+}
+
+void
+cheap_tcache_flush(struct cheap *h)
+{
+    struct cheap_tcpool *pool = h->tcpool;
+    struct cheap_tcache *tc;
+
+    assert(h->magic == (u_int64_t)h);
+
+    if (!pool)
+        return;
+
+    tc = pthread_getspecific(pool->key);
+    if (!tc)
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+    cheap_tcache_release(tc);
+    pthread_mutex_unlock(&pool->lock);
+}
+
+static void
+cheap_tcache_destroy(struct cheap *h)
+{
+    struct cheap_tcpool *pool = h->tcpool;
+    struct cheap_tcache *tc;
+
+    /* Deleting the key first ensures no thread-exit destructor can
+     * run for this pool once we have freed it.
+     */
+    pthread_key_delete(pool->key);
+
+    while ((tc = pool->list)) {
+        pool->list = tc->next;
+        free(tc);
+    }
+
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+
+    h->tcpool = NULL;
+}
+
+/* Forget every thread's chunk, e.g. because the cheap has been reset
+ * underneath them.  The caller must ensure no thread is allocating.
+ */
+static void
+cheap_tcache_reset(struct cheap *h)
+{
+    struct cheap_tcpool *pool = h->tcpool;
+    struct cheap_tcache *tc;
+
+    pthread_mutex_lock(&pool->lock);
+    for (tc = pool->list; tc; tc = tc->next) {
+        __atomic_store_n(&tc->cursorp, 0, __ATOMIC_RELAXED);
+        __atomic_store_n(&tc->limit, 0, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/* Bytes sitting unused in per-thread chunks */
+static size_t
+cheap_tcache_slack(struct cheap *h)
+{
+    struct cheap_tcpool *pool = h->tcpool;
+    struct cheap_tcache *tc;
+    size_t               slack = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (tc = pool->list; tc; tc = tc->next) {
+        u_int64_t limit = __atomic_load_n(&tc->limit, __ATOMIC_RELAXED);
+        u_int64_t cursorp = __atomic_load_n(&tc->cursorp, __ATOMIC_RELAXED);
+
+        if (limit > cursorp)
+            slack += limit - cursorp;
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return slack;
+}
+
+static inline void *
+cheap_memalign_impl(struct cheap *h, int alignment, size_t size)
+{
+    u_int64_t allocp;
+
+    assert(h->magic == (u_int64_t)h);
+
+    assert(1 == __builtin_popcount(alignment));
+
+    if (h->flags & CHEAP_F_MT)
+        return cheap_memalign_mt(h, alignment, size);
+
+    allocp = ALIGN(h->cursorp, alignment);
+
+    if (size > h->size)
+        goto full;
+
+    if ((allocp - h->base + size) > h->size)
+        goto full;
+
+    h->cursorp = allocp + size;
+    h->lastp = allocp;
+
+    return (void *)allocp;
+
+full:
+    if (h->seg && !cheap_grow(h, h->seg, size, alignment))
+        return cheap_memalign_impl(h, alignment, size);
+
+    return NULL;
+}
+
+void *
+cheap_memalign(struct cheap *h, int alignment, size_t size)
+{
+	if (alignment & (alignment - 1))
+		return NULL;
+
+	return cheap_memalign_impl(h, alignment, size);
+}
+
+/* Zero whatever part of [p, p + size) lies below the known-zero break */
+static void
+cheap_zero_dirty(struct cheap *h, void *p, size_t size)
+{
+	struct cheap_seg *seg = __atomic_load_n(&h->seg, __ATOMIC_ACQUIRE);
+	u_int64_t addr = (u_int64_t)p;
+	u_int64_t zbrk;
+
+	/* Pairs with the release cursor rewind in cheap_giveback(), which
+	 * follows the zbrk raise, for memory given back by another thread
+	 * just before we allocated it.
+	 */
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+	/* The cheap grew after we allocated, so we can't tell */
+	if (seg && (addr < seg->base || addr + size > seg->base + seg->size)) {
+		cheap_zero(p, size);
+		return;
+	}
+
+	zbrk = __atomic_load_n(cheap_zbrkp(h, seg), __ATOMIC_ACQUIRE);
+	if (addr < zbrk)
+		cheap_zero(p, min_t(size_t, size, zbrk - addr));
+}
+
+void *
+cheap_memalign_zero(struct cheap *h, int alignment, size_t size)
+{
+	void *p;
+
+	if (alignment & (alignment - 1))
+		return NULL;
+
+	p = cheap_memalign_impl(h, alignment, size);
+	if (p)
+		cheap_zero_dirty(h, p, size);
+
+	return p;
+}
+
+void *
+cheap_malloc_slow(struct cheap *h, size_t size)
+{
+	return cheap_memalign_impl(h, h->alignment, size);
+}
+
+int
+cheap_malloc_batch(struct cheap *h, const size_t *sizes, int n, void **out)
+{
+    size_t    total = 0, sz;
+    u_int64_t allocp;
+    int       i;
+
+    assert(h->magic == (u_int64_t)h);
+
+    if (n < 1)
+        return 0;
+
+    /* One pass to size the batch ... */
+    for (i = 0; i < n - 1; ++i) {
+        sz = ALIGN(sizes[i], h->alignment);
+        if (sz < sizes[i] || total + sz < total)
+            return -ENOMEM;
+        total += sz;
+    }
+
+    if (total + sizes[n - 1] < total)
+        return -ENOMEM;
+
+    /* ... one bounds check and cursor update for all of it ... */
+    allocp = (u_int64_t)cheap_memalign_impl(h, h->alignment, total + sizes[n - 1]);
+    if (!allocp)
+        return -ENOMEM;
+
+    /* ... and one pass to hand it out */
+    for (i = 0; i < n; ++i) {
+        out[i] = (void *)allocp;
+        allocp += ALIGN(sizes[i], h->alignment);
+    }
+
+    /* Let cheap_free() undo the last item of the batch, as it would
+     * have after n calls to cheap_malloc().
+     */
+    if (!(h->flags & CHEAP_F_MT))
+        h->lastp = (u_int64_t)out[n - 1];
+
+    return 0;
+}
+
+int
+cheap_malloc_n(struct cheap *h, size_t size, int n, void **out)
+{
+    size_t    stride = ALIGN(size, h->alignment);
+    u_int64_t allocp;
+    int       i;
+
+    assert(h->magic == (u_int64_t)h);
+
+    if (n < 1)
+        return 0;
+
+    if (stride < size || stride > (SIZE_MAX - size) / n)
+        return -ENOMEM;
+
+    allocp = (u_int64_t)cheap_memalign_impl(h, h->alignment, stride * (n - 1) + size);
+    if (!allocp)
+        return -ENOMEM;
+
+    for (i = 0; i < n; ++i)
+        out[i] = (void *)(allocp + i * stride);
+
+    if (!(h->flags & CHEAP_F_MT))
+        h->lastp = (u_int64_t)out[n - 1];
+
+    return 0;
+}
+
+void *
+cheap_xmalloc(struct cheap *h, size_t size)
+{
+	void *mem = cheap_malloc(h, size);
+
+	if (mem == NULL)
+		exit(-1);
+
+	return mem;
+}
+
+void
+cheap_free(struct cheap *h, void *addr)
+{
+    /* Freeing within a cheap can only occur if the user of the cheap only
+     * ever frees something that was just allocated. Once another thing has
+     * been allocated, we can't free the previously allocated thing. The
+     * use case for the free is to handle the case where the owner of the
+     * cheap needs to allocate space to ensure that it can make progress
+     * after it does something that may fail. If the failure occurs, we want
+     * to free the just-allocated space.
+     *
+     * New code should use cheap_reserve() with cheap_commit() or
+     * cheap_abort() instead, which don't need the reservation to be the
+     * last allocation and also work for MT cheaps.
+     *
+     * There is no "last" allocation in an MT cheap (lastp is never set),
+     * so this is a no-op there.
+     */
+    if (h->lastp && (u_int64_t)addr == h->lastp) {
+        cheap_brk_raise(h, h->cursorp);
+        cheap_zbrk_raise(h, h->seg, h->cursorp);
+        cheap_synclow_lower(h, h->lastp);
+        h->cursorp = h->lastp;
+        h->lastp = 0;
+    }
+}
+
+/*
+ * cheap_giveback() - return [@start, @end) if it is the newest allocation
+ *
+ * The range may have been written by the caller, so the brk high-water
+ * mark is raised to keep covering it.
+ *
+ * Return: true if the space was returned to the cheap.
+ */
+static int
+cheap_giveback(struct cheap *h, u_int64_t start, u_int64_t end)
+{
+    struct cheap_tcache *tc;
+    u_int64_t            oldp;
+
+    if (start == end)
+        return 1;
+
+    if (!(h->flags & CHEAP_F_MT)) {
+        if (h->cursorp != end)
+            return 0;
+
+        cheap_brk_raise(h, end);
+        cheap_zbrk_raise(h, h->seg, end);
+        cheap_synclow_lower(h, start);
+        h->cursorp = start;
+        h->lastp = 0;
+        return 1;
+    }
+
+    cheap_brk_raise(h, end);
+    cheap_zbrk_raise(h, __atomic_load_n(&h->seg, __ATOMIC_ACQUIRE), end);
+
+    if (h->tcpool) {
+        tc = cheap_tcache_lookup(h);
+        if (tc && tc->cursorp == end) {
+            __atomic_store_n(&tc->cursorp, start, __ATOMIC_RELAXED);
+            cheap_synclow_lower(h, start);
+            return 1;
+        }
+    }
+
+    oldp = end;
+
+    /* Release, so that a thread whose allocation reads the rewound
+     * cursor also sees the raised zbrk (see cheap_zero_dirty()).
+     */
+    if (!__atomic_compare_exchange_n(&h->cursorp, &oldp, start, 0,
+                                     __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        return 0;
+
+    cheap_synclow_lower(h, start);
+    return 1;
+}
+
+int
+cheap_reserve(struct cheap *h, struct cheap_resv *resv, size_t size)
+{
+    size_t sz = size;
+    void * addr;
+
+    resv->addr = NULL;
+    resv->size = 0;
+
+    /* MT cheaps round every allocation up to the default alignment */
+    if (h->flags & CHEAP_F_MT) {
+        sz = ALIGN(size, h->alignment);
+        if (sz < size)
+            return -ENOMEM;
+    }
+
+    addr = cheap_memalign_impl(h, h->alignment, sz);
+    if (!addr)
+        return -ENOMEM;
+
+    /* The reservation stands on its own; cheap_free() must not undo it */
+    if (!(h->flags & CHEAP_F_MT))
+        h->lastp = 0;
+
+    resv->addr = addr;
+    resv->size = sz;
+
+    return 0;
+}
+
+void *
+cheap_commit(struct cheap *h, struct cheap_resv *resv, size_t used)
+{
+    u_int64_t start, end;
+    void *    addr = resv->addr;
+
+    assert(h->magic == (u_int64_t)h);
+    assert(used <= resv->size);
+
+    if (!addr)
+        return NULL;
+
+    if (h->flags & CHEAP_F_MT)
+        used = ALIGN(used, h->alignment);
+
+    if (used < resv->size) {
+        start = (u_int64_t)addr + used;
+        end = (u_int64_t)addr + resv->size;
+
+        cheap_giveback(h, start, end);
+    }
+
+    resv->addr = NULL;
+    resv->size = 0;
+
+    return addr;
+}
+
+void
+cheap_abort(struct cheap *h, struct cheap_resv *resv)
+{
+    u_int64_t start = (u_int64_t)resv->addr;
+
+    assert(h->magic == (u_int64_t)h);
+
+    if (start)
+        cheap_giveback(h, start, start + resv->size);
+
+    resv->addr = NULL;
+    resv->size = 0;
+}
+
+/* Raise the brk high-water mark to cover everything allocated so far */
+static inline void
+cheap_brk_update(struct cheap *h)
+{
+    u_int64_t end = min_t(u_int64_t, h->cursorp, h->base + h->size);
+
+    cheap_brk_raise(h, end);
+    cheap_zbrk_raise(h, h->seg, end);
+}
+
+/* Move the cursor of the current segment back to @cursorp */
+static void
+cheap_rewind_cur(struct cheap *h, u_int64_t cursorp)
+{
+    cheap_brk_update(h);
+    cheap_synclow_lower(h, cursorp);
+
+    h->cursorp = cursorp;
+    h->lastp = 0;
+
+#if CHEAP_POISON_SZ > 0
+    /* Poison (some of) the memory that will be handed out next, to help
+     * catch callers still using memory from before the reset.  Memory
+     * above the known-zero break was never handed out, so leave it be.
+     */
+    u_int64_t zbrk = *cheap_zbrkp(h, h->seg);
+
+    if (zbrk > h->cursorp)
+        memset((void *)h->cursorp, 0xa5,
+               min_t(size_t, zbrk - h->cursorp, CHEAP_POISON_SZ));
+#endif
+}
+
+static void
+cheap_reset_impl(struct cheap *h, size_t size)
+{
+    struct cheap_seg *seg;
+
+    assert(h->magic == (u_int64_t)h);
+
+    if (h->tcpool)
+        cheap_tcache_reset(h);
+
+    /* Keep only the current (largest) segment of a growable cheap, so
+     * that the next cycle starts out with as much space as this one
+     * ended up needing.
+     */
+    if (h->seg) {
+        while ((seg = h->seg->next)) {
+            h->seg->next = seg->next;
+            cheap_seg_unmap(seg);
+        }
+        if (h->spare) {
+            cheap_seg_unmap(h->spare);
+            h->spare = NULL;
+        }
+        h->retired = 0;
+    }
+
+    size = min_t(size_t, size, h->size);
+
+    cheap_rewind_cur(h, h->base + size);
+}
+
+u_int64_t
+cheap_mark(struct cheap *h)
+{
+    assert(h->magic == (u_int64_t)h);
+
+    return __atomic_load_n(&h->cursorp, __ATOMIC_RELAXED);
+}
+
+static void
+cheap_rewind_impl(struct cheap *h, u_int64_t mark)
+{
+    struct cheap_seg *seg;
+
+    assert(h->magic == (u_int64_t)h);
+
+    if (h->tcpool)
+        cheap_tcache_reset(h);
+
+    /* A mark is never beyond the cursor of its segment (which matters
+     * when one segment ends exactly where another begins).
+     */
+    if (mark >= h->base &&
+        mark <= min_t(u_int64_t, h->cursorp, h->base + h->size)) {
+        cheap_rewind_cur(h, mark);
+        return;
+    }
+
+    /* The mark is in a retired segment of a growable cheap.  Give up
+     * every newer segment, keeping the largest as a spare for the next
+     * time the cheap grows.
+     */
+    assert(h->seg);
+
+    for (seg = h->seg->next; seg; seg = seg->next) {
+        if (mark >= seg->base && mark <= seg->base + seg->used)
+            break;
+    }
+
+    assert(seg);
+    if (!seg)
+        return;
+
+    while (h->seg != seg) {
+        struct cheap_seg *old = h->seg;
+
+        /* Save the state of the current segment ... */
+        cheap_brk_update(h);
+        old->brk = h->brk;
+
+        /* ... and make the one before it current again */
+        h->seg      = old->next;
+        h->retired -= h->seg->used;
+        h->mem      = h->seg->mem;
+        h->base     = h->seg->base;
+        h->size     = h->seg->size;
+        h->brk      = h->seg->brk;
+        h->pagesz   = h->seg->pagesz;
+        h->cursorp  = h->seg->base + h->seg->used;
+
+        if (!h->spare || h->spare->size < old->size) {
+            if (h->spare)
+                cheap_seg_unmap(h->spare);
+            h->spare = old;
+        } else {
+            cheap_seg_unmap(old);
+        }
+    }
+
+    cheap_rewind_cur(h, mark);
+}
+
+static void
+cheap_trim_impl(struct cheap *h, size_t rss)
+{
+    u_int64_t addr, end;
+    int       rc;
+
+    assert(h->magic == (u_int64_t)h);
+
+    /* Don't discard the contents of a device or file */
+    if (h->mfd)
+        return;
+
+    cheap_brk_update(h);
+
+    /* Never release memory that is still allocated */
+    rss = max_t(size_t, rss, h->cursorp - h->base);
+
+    /* Huge pages can only be released whole */
+    addr = ALIGN(h->base + rss, h->pagesz);
+    end = ALIGN(h->brk, h->pagesz);
+    if (addr >= end)
+        return;
+
+    /* For a shared mapping (i.e., shmem) MADV_DONTNEED only zaps the
+     * page tables; MADV_REMOVE actually frees the pages.  Either way,
+     * the pages read back as zero.
+     */
+    rc = -1;
+    if (!(h->flags & CHEAP_F_PRIVATE))
+        rc = madvise((void *)addr, end - addr, MADV_REMOVE);
+    if (rc)
+        rc = madvise((void *)addr, end - addr, MADV_DONTNEED);
+    if (!rc) {
+        u_int64_t *zbrkp = cheap_zbrkp(h, h->seg);
+
+        /* The released pages read back as zero */
+        h->brk = addr;
+        if (*zbrkp > addr)
+            *zbrkp = addr;
+    }
+}
+
+/* The prefault thread (if any) must not run while the cheap is being
+ * reset, rewound or trimmed, as those may unmap or release pages.
+ */
+
+void
+cheap_reset(struct cheap *h, size_t size)
+{
+    cheap_prefault_pause(h);
+    cheap_reset_impl(h, size);
+    cheap_prefault_resume(h);
+}
+
+void
+cheap_rewind(struct cheap *h, u_int64_t mark)
+{
+    cheap_prefault_pause(h);
+    cheap_rewind_impl(h, mark);
+    cheap_prefault_resume(h);
+}
+
+void
+cheap_trim(struct cheap *h, size_t rss)
+{
+    cheap_prefault_pause(h);
+    cheap_trim_impl(h, rss);
+    cheap_prefault_resume(h);
+}
+
+/* Bytes used in the current segment */
+static size_t
+cheap_used_cur(struct cheap *h)
+{
+    u_int64_t cursorp = __atomic_load_n(&h->cursorp, __ATOMIC_RELAXED);
+    size_t    used;
+
+    used = min_t(size_t, h->size, (cursorp - h->base));
+
+    if (h->tcpool)
+        used -= min_t(size_t, used, cheap_tcache_slack(h));
+
+    return used;
+}
+
+size_t
+cheap_used(struct cheap *h)
+{
+    assert(h->magic == (u_int64_t)h);
+
+    return h->retired + cheap_used_cur(h);
 }
 
 size_t
@@ -232,5 +2077,13 @@ cheap_avail(struct cheap *h)
 {
     assert(h->magic == (u_int64_t)h);
 
-    return h->size - cheap_used(h);
+    return h->size - cheap_used_cur(h);
+}
+
+size_t
+cheap_pagesize(struct cheap *h)
+{
+    assert(h->magic == (u_int64_t)h);
+
+    return h->pagesz;
 }
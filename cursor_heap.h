@@ -10,6 +10,7 @@
 #include <string.h>
 #include <time.h>
 #include <assert.h>
+#include <pthread.h>
 #include <sys/user.h>
 
 #define MIN(a, b) ((a) > (b)) ? (b) : (a)
@@ -54,6 +55,106 @@ get_cycles(void)
  */
 #define IS_ALIGNED(x, a) (((x) & ((typeof(x))(a)-1)) == 0)
 
+/* Flags for cheap_create_flags()
+ *
+ * CHEAP_F_MT:  Allocation may be called concurrently from many threads.
+ *              The cursor is advanced with atomic fetch-add/cmpxchg, and
+ *              cheap_free() becomes a no-op.
+ *
+ * CHEAP_F_GROW:    When the cheap is full, map a new segment (at least
+ *                  twice the size of the last) and carry on allocating
+ *                  from it, rather than failing.  All segments are
+ *                  unmapped by cheap_destroy().
+ *
+ * CHEAP_F_HUGE_2M: Back the cheap with explicit (hugetlb) 2MiB pages.
+ * CHEAP_F_HUGE_1G: Back the cheap with explicit (hugetlb) 1GiB pages,
+ *                  rounding its size up to a multiple of 1GiB.
+ *                  If the kernel has no huge pages to give, 1G falls
+ *                  back to 2M, and 2M falls back to base pages.  The
+ *                  flags of the cheap reflect what was actually used.
+ *
+ * CHEAP_F_HUGE_MEMFD:  Get the huge pages from a hugetlbfs memfd rather
+ *                      than a MAP_HUGETLB mapping.  Requires one of the
+ *                      HUGE flags above.
+ *
+ * CHEAP_F_THP:     Use a private, 2MiB aligned mapping and ask for
+ *                  transparent huge pages with MADV_HUGEPAGE.  Needs no
+ *                  hugetlb reservation, but the kernel may not oblige.
+ *                  Implies CHEAP_F_PRIVATE.
+ *
+ * CHEAP_F_PRIVATE: Map the cheap MAP_PRIVATE rather than MAP_SHARED, so
+ *                  that it is ordinary anonymous memory instead of shmem
+ *                  (cheaper faults, eligible for THP, and copy-on-write
+ *                  rather than shared after fork()).
+ *
+ * CHEAP_F_DONTFORK:    Don't map the cheap into children at all
+ *                      (MADV_DONTFORK).
+ *
+ * CHEAP_F_WIPEONFORK:  Children see the cheap as zero-filled memory
+ *                      (MADV_WIPEONFORK).  Requires CHEAP_F_PRIVATE and
+ *                      base or transparent huge pages.
+ *
+ * CHEAP_F_POPULATE:    Fault in the whole cheap at create time (and each
+ *                      new segment as it is mapped), using as many
+ *                      threads as make sense.  See cheap_populate().
+ */
+#define CHEAP_F_MT          0x0001u
+#define CHEAP_F_GROW        0x0002u
+#define CHEAP_F_HUGE_2M     0x0004u
+#define CHEAP_F_HUGE_1G     0x0008u
+#define CHEAP_F_HUGE_MEMFD  0x0010u
+#define CHEAP_F_THP         0x0020u
+#define CHEAP_F_PRIVATE     0x0040u
+#define CHEAP_F_DONTFORK    0x0080u
+#define CHEAP_F_WIPEONFORK  0x0100u
+#define CHEAP_F_POPULATE    0x0200u
+
+#define CHEAP_F_HUGE_MASK   (CHEAP_F_HUGE_2M | CHEAP_F_HUGE_1G | CHEAP_F_HUGE_MEMFD)
+
+#define CHEAP_F_FORK_MASK   (CHEAP_F_DONTFORK | CHEAP_F_WIPEONFORK)
+
+#define CHEAP_F_MASK                                                    \
+    (CHEAP_F_MT | CHEAP_F_GROW | CHEAP_F_HUGE_MASK | CHEAP_F_THP |      \
+     CHEAP_F_PRIVATE | CHEAP_F_FORK_MASK | CHEAP_F_POPULATE)
+
+#define CHEAP_HUGE_2M_SZ    (2ul << 20)
+#define CHEAP_HUGE_1G_SZ    (1ul << 30)
+
+/* Number of bytes poisoned by cheap_reset() (debug builds only) */
+#ifndef NDEBUG
+#define CHEAP_POISON_SZ         (1024)
+#else
+#define CHEAP_POISON_SZ         (0)
+#endif
+
+/* Defaults for cheap_prefault_start() */
+#define CHEAP_PREFAULT_WINDOW   (32ul << 20)
+#define CHEAP_PREFAULT_CHUNK    (2ul << 20)
+
+/* Default chunk size for cheap_tcache_enable() */
+#define CHEAP_TCACHE_CHUNKSZ    (256u << 10)
+
+struct cheap_tcpool;
+struct cheap_prefault;
+
+/* One mapping of a CHEAP_F_GROW cheap.  The current segment is always
+ * the head of the list, and its base and size are mirrored in the cheap
+ * itself so that allocation never needs to look here.
+ */
+struct cheap_seg {
+    struct cheap_seg *next;
+    void *            mem;
+    size_t            len;
+    u_int64_t         base;
+    size_t            size;
+    size_t            used;
+    u_int64_t         brk;
+    u_int64_t         zbrk;
+    size_t            pagesz;
+};
+
+struct cheap_dax_hdr;
+
 /* Everything in this structure is opaque to callers (but not really,
  * because the cheap unit tests need access to the implementation).
  */
@@ -68,6 +169,20 @@ struct cheap {
     u_int64_t magic;
     int       mfd;
     int       mapped;
+    int       mapsync;
+    u_int32_t flags;
+    size_t    pagesz;
+    u_int64_t zbrk;
+    struct cheap_tcpool *tcpool;
+    struct cheap_seg *   seg;
+    struct cheap_seg *   spare;
+    size_t               retired;
+    pthread_mutex_t      seg_lock;
+    int                  numa_mpol;
+    u_int64_t            numa_nodes;
+    struct cheap_prefault *prefault;
+    struct cheap_dax_hdr * hdr;
+    u_int64_t              synclow;   /* Lowest cursor since cheap_sync() */
 };
 
 /**
@@ -82,6 +197,221 @@ struct cheap {
 struct cheap *
 cheap_create(int alignment, size_t size);
 
+/**
+ * cheap_create_flags() - Create a cursor heap with optional behaviors
+ *
+ * @alignment:  Alignment for cheap_alloc() (must be a power of 2 from 0 to 64)
+ * @size:       Size of the cursor heap
+ * @flags:      Zero or more of the CHEAP_F_* flags
+ *
+ * Return: Returns a ptr to a struct cheap if successful, otherwise NULL.
+ */
+struct cheap *
+cheap_create_flags(int alignment, size_t size, u_int32_t flags);
+
+/**
+ * cheap_create_mt() - Create a cursor heap that may be shared by threads
+ *
+ * @alignment:  Alignment for cheap_alloc() (must be a power of 2 from 0 to 64)
+ * @size:       Size of the cursor heap
+ *
+ * Same as cheap_create_flags(alignment, size, CHEAP_F_MT).  All of the
+ * allocation functions may be called concurrently without locking.
+ * Allocation sizes are rounded up to @alignment so that the shared
+ * cursor stays aligned.
+ *
+ * Return: Returns a ptr to a struct cheap if successful, otherwise NULL.
+ */
+struct cheap *
+cheap_create_mt(int alignment, size_t size);
+
+/**
+ * cheap_tcache_enable() - Give each thread a private chunk of an MT cheap
+ *
+ * @h:          A cheap created with CHEAP_F_MT
+ * @chunksz:    Size of the chunk each thread carves from @h (0 selects
+ *              CHEAP_TCACHE_CHUNKSZ)
+ *
+ * Once enabled, each thread that allocates from @h grabs @chunksz bytes
+ * from the shared cursor and bump-allocates from that privately, going
+ * back to @h only when its chunk runs out.  Requests larger than a quarter
+ * of @chunksz bypass the chunk.  The unused tail of a thread's chunk is
+ * returned to @h when the thread exits or calls cheap_tcache_flush(), if
+ * nothing has been allocated from @h after it.  cheap_used() does not
+ * count space sitting unused in per-thread chunks.
+ *
+ * Must be called before any thread allocates from @h.
+ *
+ * Return: 0 on success, -EINVAL if @h is not an MT cheap or already has
+ * thread caches enabled, or -ENOMEM.
+ */
+int
+cheap_tcache_enable(struct cheap *h, size_t chunksz);
+
+/**
+ * cheap_tcache_flush() - Give back the calling thread's chunk
+ * @h:  the cheap
+ *
+ * Useful for long-lived pool threads that are done with @h but will not
+ * exit.  The next allocation by this thread grabs a new chunk.
+ */
+void
+cheap_tcache_flush(struct cheap *h);
+
+/* NUMA placement policies for cheap_create_numa() */
+enum cheap_numa_mode {
+    CHEAP_NUMA_BIND = 1,        /* Only allocate from the given nodes */
+    CHEAP_NUMA_PREFERRED,       /* Prefer the (one) given node */
+    CHEAP_NUMA_INTERLEAVE,      /* Interleave pages across the given nodes */
+};
+
+struct cheap_numa_policy {
+    enum cheap_numa_mode mode;
+    u_int64_t            nodemask;  /* Bit n selects node n */
+    u_int32_t            flags;     /* CHEAP_F_* flags for the cheap */
+};
+
+/**
+ * cheap_create_numa() - Create a cursor heap with a NUMA placement policy
+ *
+ * @alignment:  Alignment for cheap_alloc() (must be a power of 2 from 0 to 64)
+ * @size:       Size of the cursor heap
+ * @policy:     Where to place the pages of the cheap
+ *
+ * The policy is applied with mbind(2) before any page of the cheap is
+ * touched (and to each new segment of a CHEAP_F_GROW cheap), so it
+ * governs every page fault rather than depending on which thread
+ * happens to touch a page first.  CHEAP_NUMA_PREFERRED takes exactly
+ * one node.  No libnuma is required.
+ *
+ * Return: Returns a ptr to a struct cheap if successful, otherwise NULL
+ * (with errno set).
+ */
+struct cheap *
+cheap_create_numa(int alignment, size_t size,
+                  const struct cheap_numa_policy *policy);
+
+/**
+ * cheap_numa_stat() - Report where the pages of a cheap reside
+ *
+ * @h:          ptr to a cheap
+ * @bytesv:     On return, bytesv[n] is the number of bytes of @h resident
+ *              on node n
+ * @nnodes:     Number of elements in @bytesv
+ *
+ * Works for any cheap, whether or not it has a NUMA policy.  Pages that
+ * have never been touched are not resident anywhere.
+ *
+ * Return: total bytes resident, otherwise -errno.
+ */
+ssize_t
+cheap_numa_stat(struct cheap *h, size_t *bytesv, int nnodes);
+
+/* A CPU to NUMA node map, for cheap_set_create_topo() */
+struct cheap_topo {
+    int        nnodes;
+    int        ncpus;
+    const int *cpu_node;    /* cpu_node[cpu] is the node of cpu */
+};
+
+/* One MT cheap per NUMA node.  Opaque to callers (but the unit tests
+ * look inside).
+ */
+struct cheap_set {
+    u_int64_t      magic;
+    int            nnodes;
+    int            ncpus;
+    int *          cpu_node;
+    struct cheap **heapv;
+};
+
+/**
+ * cheap_set_create() - Create one cursor heap per NUMA node
+ *
+ * @alignment:  Alignment for cheap_alloc() (must be a power of 2 from 0 to 64)
+ * @size:       Size of each node's cursor heap
+ * @flags:      CHEAP_F_* flags for each cursor heap (CHEAP_F_MT is implied)
+ *
+ * Each node's cheap prefers that node's memory (CHEAP_NUMA_PREFERRED).
+ * The cheap_set_*() allocation functions route each call to the cheap
+ * of the node the calling thread is running on (per sched_getcpu(),
+ * which glibc answers from rseq or the vDSO without a system call).
+ * Nodes whose memory can't be bound (e.g. memoryless nodes) get an
+ * unbound cheap.
+ *
+ * Return: Returns a ptr to a struct cheap_set if successful, otherwise NULL.
+ */
+struct cheap_set *
+cheap_set_create(int alignment, size_t size, u_int32_t flags);
+
+/**
+ * cheap_set_create_topo() - Create a cheap set for a given topology
+ *
+ * @alignment:  Alignment for cheap_alloc() (must be a power of 2 from 0 to 64)
+ * @size:       Size of each node's cursor heap
+ * @flags:      CHEAP_F_* flags for each cursor heap (CHEAP_F_MT is implied)
+ * @topo:       CPU to node map to use instead of the machine's
+ *
+ * Same as cheap_set_create(), but routes by @topo (which is copied).
+ * Mostly for testing: nodes in @topo that the machine doesn't have get
+ * unbound cheaps, and CPUs not in @topo are routed to node 0.
+ *
+ * Return: Returns a ptr to a struct cheap_set if successful, otherwise NULL.
+ */
+struct cheap_set *
+cheap_set_create_topo(int alignment, size_t size, u_int32_t flags,
+                      const struct cheap_topo *topo);
+
+/**
+ * cheap_set_destroy() - destroy a cheap set and all of its cheaps
+ * @set:  the set to destroy (may be NULL)
+ */
+void
+cheap_set_destroy(struct cheap_set *set);
+
+/**
+ * cheap_set_local() - return the cheap local to the calling thread
+ * @set:  ptr to a cheap set
+ */
+struct cheap *
+cheap_set_local(struct cheap_set *set);
+
+/**
+ * cheap_set_heap() - return the cheap of a given node
+ * @set:   ptr to a cheap set
+ * @node:  node number (less than the number of nodes in @set)
+ */
+struct cheap *
+cheap_set_heap(struct cheap_set *set, int node);
+
+/**
+ * cheap_set_malloc() - allocate from the cheap local to the calling thread
+ * @set:   ptr to a cheap set
+ * @size:  size in bytes of the desired allocation
+ *
+ * Same as cheap_malloc(cheap_set_local(set), size).
+ */
+void *
+cheap_set_malloc(struct cheap_set *set, size_t size);
+
+/**
+ * cheap_set_memalign() - aligned allocation from the local cheap
+ * @set:        ptr to a cheap set
+ * @alignment:  power of 2
+ * @size:       size in bytes of the desired allocation
+ *
+ * Same as cheap_memalign(cheap_set_local(set), alignment, size).
+ */
+void *
+cheap_set_memalign(struct cheap_set *set, size_t alignment, size_t size);
+
+/**
+ * cheap_set_used() - return number of bytes used in all of a set's cheaps
+ * @set:  ptr to a cheap set
+ */
+size_t
+cheap_set_used(struct cheap_set *set);
+
 /**
  * cheap_create_dax() - Create a cursor heap from an entire DAX device
  *
@@ -94,6 +424,255 @@ cheap_create(int alignment, size_t size);
 struct cheap *
 cheap_create_dax(const char *devpath, int alignment);
 
+/**
+ * cheap_create_dax_range() - Create a cursor heap from part of a DAX device
+ *
+ * @path:       dax device, pmem device or file to map
+ * @offset:     Offset of the range within @path
+ * @len:        Length of the range (0 for everything from @offset on)
+ * @alignment:  Alignment for cheap_alloc() (must be a power of 2 from 0 to 64)
+ *
+ * Lets several cheaps (e.g. one per shard) share one device without
+ * carving it into separate devices via daxctl.  The ranges are the
+ * caller's to keep disjoint.  A devdax device can only be mapped in units
+ * of its alignment (2MiB or 1GiB, see /sys/dev/char/<major>:<minor>/align),
+ * so @offset and @len must be multiples of it; for pmem block devices
+ * and regular files they must be multiples of the page size.  With @len 0
+ * any partial unit at the end of @path is left out.
+ *
+ * Return: Returns a ptr to a struct cheap if successful, otherwise NULL
+ * with errno set (EINVAL if the range is misaligned or out of bounds).
+ */
+struct cheap *
+cheap_create_dax_range(const char *path, off_t offset, size_t len,
+		       int alignment);
+
+/**
+ * cheap_create_dax_multi() - Create a cursor heap spanning several DAX devices
+ *
+ * @paths:      dax devices, pmem devices or files to map
+ * @n:          number of entries in @paths
+ * @alignment:  Alignment for cheap_alloc() (must be a power of 2 from 0 to 64)
+ *
+ * Reserves one virtual range and maps the devices into it back to back,
+ * in order, so a single cheap has the capacity of all of them.  Each
+ * device is mapped in whole units of its alignment (see
+ * cheap_create_dax_range()); any partial unit at its end is left out.
+ * Each device must also start at a multiple of its alignment, so when
+ * mixing alignments (e.g. files and 2MiB devdax) list the larger ones
+ * first, or size the smaller ones in multiples of the larger.
+ *
+ * Return: Returns a ptr to a struct cheap if successful, otherwise NULL
+ * with errno set (EINVAL if a device would start misaligned).
+ */
+struct cheap *
+cheap_create_dax_multi(const char **paths, int n, int alignment);
+
+/**
+ * cheap_create_dax_striped() - Create a cursor heap striped across DAX devices
+ *
+ * @paths:      dax devices, pmem devices or files to map
+ * @n:          number of entries in @paths
+ * @stripe:     stripe size, a multiple of every device's alignment
+ * @alignment:  Alignment for cheap_alloc() (must be a power of 2 from 0 to 64)
+ *
+ * Like cheap_create_dax_multi(), but the range is interleaved across the
+ * devices @stripe bytes at a time, so that allocations (and sequential
+ * accesses) spread across all of their bandwidth.  The same amount of each
+ * device is used: that of the smallest, rounded down to @stripe.  Each
+ * stripe is a separate mapping, so keep (size / @stripe) well below
+ * vm.max_map_count.
+ *
+ * Return: Returns a ptr to a struct cheap if successful, otherwise NULL
+ * with errno set.
+ */
+struct cheap *
+cheap_create_dax_striped(const char **paths, int n, size_t stripe,
+			 int alignment);
+
+/**
+ * cheap_format_dax() - Create a persistent cursor heap on a DAX device
+ *
+ * @path:       dax device, pmem device or (fs-dax) file to map
+ * @alignment:  Alignment for cheap_alloc() (must be a power of 2 from 1 to 64)
+ *
+ * Like cheap_create_dax(), but the heap's metadata (alignment, size and
+ * cursor) is kept in a header at the start of the device, so that the
+ * heap can be reattached with cheap_open_dax() after the process exits.
+ * The header takes one unit of the device alignment (a page for pmem and
+ * files, 2MiB or 1GiB for devdax).  Any existing heap on @path is lost.
+ *
+ * Return: Returns a ptr to a struct cheap if successful, otherwise NULL
+ * with errno set.
+ */
+struct cheap *
+cheap_format_dax(const char *path, int alignment);
+
+/**
+ * cheap_open_dax() - Reattach to a persistent cursor heap
+ *
+ * @path:  dax device, pmem device or file formatted by cheap_format_dax()
+ *
+ * Allocation resumes at the cursor recorded by the last cheap_sync() (or
+ * cheap_destroy()).  The mapping may land at a different address than it
+ * did before, so pointers stored in the heap should be stored as offsets
+ * (see cheap_off() and cheap_ptr()).
+ *
+ * Return: Returns a ptr to a struct cheap if successful, otherwise NULL
+ * with errno set (EINVAL if @path does not hold a valid heap).
+ */
+struct cheap *
+cheap_open_dax(const char *path);
+
+/**
+ * cheap_sync() - Make a persistent cheap's allocations durable
+ *
+ * @h:  ptr to a cheap from cheap_format_dax() or cheap_open_dax()
+ *
+ * Persists (see cheap_persist()) what was allocated since the last
+ * cheap_sync(), including anything handed out again after a rewind,
+ * reset or free, then records the cursor in the on-media header.  The
+ * cursor is a single 8-byte store, persisted only after what it covers,
+ * so a crash at any point leaves a consistent heap.  Changes to earlier
+ * allocations are the caller's to persist.  cheap_destroy() does this too.
+ *
+ * Return: 0 on success, -EINVAL if @h is not persistent, otherwise -errno.
+ */
+int
+cheap_sync(struct cheap *h);
+
+/**
+ * cheap_persist() - Make a range of a DAX/pmem/file backed cheap durable
+ *
+ * @h:    ptr to a cheap backed by a device or file
+ * @p:    start of the range
+ * @len:  length of the range
+ *
+ * If the mapping is synchronous (devdax, or an fs-dax file, which are
+ * mapped with MAP_SYNC when possible), this writes back the range's
+ * cache lines with the best instruction the CPU has (see cheap_flush())
+ * and fences.  Otherwise (e.g. a pmem block device or regular file, in the
+ * page cache), it falls back to msync() of the pages the range touches.
+ *
+ * Return: 0 on success, -EINVAL if @h is not backed by a device or file,
+ * otherwise -errno.
+ */
+int
+cheap_persist(struct cheap *h, const void *p, size_t len);
+
+/**
+ * cheap_flush() - write back cache lines to memory, and fence
+ * @p:    start of the range
+ * @len:  length of the range
+ *
+ * Uses CLWB, CLFLUSHOPT or CLFLUSH (the best of them the CPU supports,
+ * per CPUID), followed by SFENCE.  Does nothing on other architectures.
+ */
+void
+cheap_flush(const void *p, size_t len);
+
+/**
+ * cheap_flush_isa() - name the instruction cheap_flush() uses
+ */
+const char *
+cheap_flush_isa(void);
+
+/**
+ * cheap_flush_select() - choose the instruction cheap_flush() uses
+ * @name:  "clwb", "clflushopt" or "clflush", or NULL for the best one
+ *
+ * This is for benchmarking; the default needs no help.
+ *
+ * Return: 0 on success, -ENOTSUP if the CPU lacks @name, -EINVAL if
+ * @name is unknown.
+ */
+int
+cheap_flush_select(const char *name);
+
+/**
+ * cheap_off() - convert a pointer into a persistent cheap to an offset
+ * @h:  a cheap from cheap_format_dax() or cheap_open_dax()
+ * @p:  pointer into @h (or NULL)
+ *
+ * Offsets are from the start of the mapping, which holds the header, so
+ * no allocation is ever at offset 0.
+ *
+ * Return: The offset of @p in @h, or 0 if @p is NULL.
+ */
+static inline u_int64_t
+cheap_off(struct cheap *h, const void *p)
+{
+    assert(h->hdr);
+
+    return p ? (u_int64_t)p - (u_int64_t)h->hdr : 0;
+}
+
+/**
+ * cheap_ptr() - convert an offset from cheap_off() back to a pointer
+ * @h:    a cheap from cheap_format_dax() or cheap_open_dax()
+ * @off:  offset in @h (or 0)
+ *
+ * Return: A pointer to @off in @h's current mapping, or NULL if @off is 0.
+ */
+static inline void *
+cheap_ptr(struct cheap *h, u_int64_t off)
+{
+    assert(h->hdr);
+
+    return off ? (char *)h->hdr + off : NULL;
+}
+
+/**
+ * cheap_populate() - Fault in (part of) a cheap ahead of time
+ *
+ * @h:          ptr to a cheap (anonymous or DAX)
+ * @len:        Bytes to populate from the start of the cheap (0 for all
+ *              of it; for a CHEAP_F_GROW cheap, the current segment)
+ * @nthreads:   Number of threads to split the work across (0 picks one
+ *              per 64MiB, up to the number of CPUs the caller may use)
+ *
+ * Takes the page faults up front (via MADV_POPULATE_WRITE, or by
+ * touching each page on older kernels) so that the first pass of
+ * allocations doesn't.  The contents of the cheap are not changed.
+ * Unless the cheap has a NUMA policy, the helper threads are confined to
+ * the caller's node so that the pages land where the caller's own first
+ * touch would have put them.
+ *
+ * Return: 0 on success, otherwise -errno.
+ */
+int
+cheap_populate(struct cheap *h, size_t len, int nthreads);
+
+/**
+ * cheap_prefault_start() - Keep a window beyond the cursor faulted in
+ *
+ * @h:          ptr to a cheap
+ * @window:     Bytes beyond the cursor to keep populated (0 selects
+ *              CHEAP_PREFAULT_WINDOW)
+ * @chunk:      Bytes to populate at a time (0 selects CHEAP_PREFAULT_CHUNK)
+ *
+ * An alternative to populating a cheap that is sized for the worst case:
+ * starts a helper thread that watches the cursor and populates (as with
+ * cheap_populate()) up to @window bytes ahead of it, @chunk bytes at a
+ * time, so that allocating threads don't take the page faults.  The
+ * thread polls, backing off while the cursor is idle.  It pauses during
+ * cheap_reset(), cheap_rewind() and cheap_trim(), and follows a
+ * CHEAP_F_GROW cheap into each new segment.
+ *
+ * Return: 0 on success, -EBUSY if already running, otherwise -errno.
+ */
+int
+cheap_prefault_start(struct cheap *h, size_t window, size_t chunk);
+
+/**
+ * cheap_prefault_stop() - Stop the thread started by cheap_prefault_start()
+ * @h:  ptr to a cheap
+ *
+ * Called by cheap_destroy() if need be.
+ */
+void
+cheap_prefault_stop(struct cheap *h);
+
 /**
  * cheap_destroy() - destroy a cheap
  * @h:  the cheap to destroy
@@ -104,19 +683,81 @@ cheap_create_dax(const char *devpath, int alignment);
 void
 cheap_destroy(struct cheap *h);
 
+/**
+ * cheap_malloc_slow() - out-of-line cheap_malloc()
+ * @h:      the cheap from which to allocate
+ * @size:   size in bytes of the desired allocation
+ *
+ * Handles every case (MT cheaps, thread caches, growing, a full cheap);
+ * cheap_malloc() calls it for anything but the single threaded fast path.
+ */
+void *
+cheap_malloc_slow(struct cheap *h, size_t size);
+
 /**
  * cheap_malloc() - allocate space from a cheap
  * @h:      the cheap from which to allocate
  * @size:   size in bytes of the desired allocation
  *
  * This function has the same general calling convention and semantics
- * as malloc().
+ * as malloc().  The common case (a single threaded cheap with room for
+ * @size at the default alignment) is inline, so that in a loop the
+ * compiler can keep the cheap's fields in registers and merge checks.
  *
  * Return: Returns a pointer to the allocated memory if succussful,
  * otherwise returns NULL.
  */
-void *
-cheap_malloc(struct cheap *h, size_t size);
+static inline void *
+cheap_malloc(struct cheap *h, size_t size)
+{
+    u_int64_t allocp;
+
+    assert(h->magic == (u_int64_t)h);
+
+    if (__builtin_expect(!(h->flags & CHEAP_F_MT), 1)) {
+        allocp = ALIGN(h->cursorp, h->alignment);
+
+        if (__builtin_expect(size <= h->size &&
+                             allocp - h->base + size <= h->size, 1)) {
+            h->cursorp = allocp + size;
+            h->lastp = allocp;
+            return (void *)allocp;
+        }
+    }
+
+    return cheap_malloc_slow(h, size);
+}
+
+/**
+ * cheap_malloc_batch() - allocate several items from a cheap at once
+ * @h:      the cheap from which to allocate
+ * @sizes:  size in bytes of each item
+ * @n:      number of items
+ * @out:    filled in with a pointer to each item
+ *
+ * Equivalent to @n calls to cheap_malloc(), but with one bounds check
+ * and one cursor update for the whole batch.  Each item is aligned to
+ * the default alignment of the cheap.  Either all items are allocated or
+ * none are.
+ *
+ * Return: 0 on success, -ENOMEM if the batch does not fit.
+ */
+int
+cheap_malloc_batch(struct cheap *h, const size_t *sizes, int n, void **out);
+
+/**
+ * cheap_malloc_n() - allocate several items of the same size at once
+ * @h:      the cheap from which to allocate
+ * @size:   size in bytes of each item
+ * @n:      number of items
+ * @out:    filled in with a pointer to each item
+ *
+ * Same as cheap_malloc_batch() with every size equal to @size.
+ *
+ * Return: 0 on success, -ENOMEM if the batch does not fit.
+ */
+int
+cheap_malloc_n(struct cheap *h, size_t size, int n, void **out);
 
 /**
  * Same as cheap_malloc, but exits if an allocation fails
@@ -124,13 +765,60 @@ cheap_malloc(struct cheap *h, size_t size);
 void *
 cheap_xmalloc(struct cheap *h, size_t size);
 
+/* Zeroing at least this many bytes uses non-temporal stores */
+#define CHEAP_ZERO_NT_MIN       (2ul << 20)
+
+/**
+ * cheap_zero_nt() - zero memory without pulling it into the cache
+ * @p:      start of the memory
+ * @len:    number of bytes to zero
+ *
+ * Uses AVX-512, AVX2 or SSE2 streaming stores (whichever is the widest
+ * the CPU supports), falling back to memset() on other architectures.
+ */
+void
+cheap_zero_nt(void *p, size_t len);
+
+/**
+ * cheap_zero_isa() - name the instruction set cheap_zero_nt() uses
+ */
+const char *
+cheap_zero_isa(void);
+
+/**
+ * cheap_zero() - zero memory, bypassing the cache for large sizes
+ * @p:      start of the memory
+ * @len:    number of bytes to zero
+ */
+static inline void
+cheap_zero(void *p, size_t len)
+{
+    if (len < CHEAP_ZERO_NT_MIN)
+        memset(p, 0, len);
+    else
+        cheap_zero_nt(p, len);
+}
+
+/**
+ * cheap_memalign_zero() - allocate aligned, zeroed storage from a cheap
+ * @h:          the cheap from which to allocate
+ * @alignment:  the desired alignment
+ * @size:       size in bytes of the desired allocation
+ *
+ * Same as cheap_memalign(), but the memory is zeroed as for cheap_calloc().
+ */
+void *
+cheap_memalign_zero(struct cheap *h, int alignment, size_t size);
+
 /**
  * cheap_calloc() - allocate zeroed space from a cheap
  * @h:      the cheap from which to allocaet
  * @size:   size in bytes of the desired allocation
  *
  * This function has the same general calling convention and semantics
- * as calloc().
+ * as calloc().  Memory that has not been handed out since it was last
+ * known to be zero (e.g. fresh anonymous memory, or pages released by
+ * cheap_trim()) is not written, so it isn't faulted in either.
  *
  * Return: Returns a pointer to the allocated memory if succussful,
  * otherwise returns NULL.
@@ -138,18 +826,65 @@ cheap_xmalloc(struct cheap *h, size_t size);
 static inline void *
 cheap_calloc(struct cheap *h, size_t size)
 {
-    void *mem;
-
-    mem = cheap_malloc(h, size);
-    if (mem)
-        memset(mem, 0, size);
-
-    return mem;
+    return cheap_memalign_zero(h, (int)h->alignment, size);
 }
 
 void
 cheap_free(struct cheap *h, void *addr);
 
+/**
+ * struct cheap_resv - space reserved by cheap_reserve()
+ * @addr:   start of the reserved space (NULL if none)
+ * @size:   size of the reserved space
+ */
+struct cheap_resv {
+    void * addr;
+    size_t size;
+};
+
+/**
+ * cheap_reserve() - reserve space for a later commit or abort
+ * @h:      the cheap from which to reserve
+ * @resv:   filled in with the reservation
+ * @size:   size in bytes to reserve (at the default alignment)
+ *
+ * Lock in @size bytes up front, so that a caller who must not fail part
+ * way through an operation finds out before it starts.  The space is
+ * carved off immediately; other allocations (from any thread, for an MT
+ * cheap) simply go past it, and nothing touches the cursor again until
+ * the reservation is committed or aborted.
+ *
+ * Return: 0 on success, -ENOMEM if @size bytes are not available.
+ */
+int
+cheap_reserve(struct cheap *h, struct cheap_resv *resv, size_t size);
+
+/**
+ * cheap_commit() - use (part of) a reservation
+ * @h:      the cheap the reservation came from
+ * @resv:   the reservation
+ * @used:   number of bytes actually needed (at most @resv->size)
+ *
+ * If nothing has been allocated after the reservation, its unused tail
+ * is returned to the cheap.
+ *
+ * Return: the start of the committed space, i.e. @resv->addr.
+ */
+void *
+cheap_commit(struct cheap *h, struct cheap_resv *resv, size_t used);
+
+/**
+ * cheap_abort() - give up a reservation
+ * @h:      the cheap the reservation came from
+ * @resv:   the reservation
+ *
+ * The space is returned to the cheap if nothing has been allocated
+ * after the reservation, otherwise it remains used until the cheap is
+ * reset or destroyed.
+ */
+void
+cheap_abort(struct cheap *h, struct cheap_resv *resv);
+
 /**
  * cheap_memalign() - allocate aligned storage from a cheap
  * @h:          the cheap from which to allocate
@@ -165,15 +900,76 @@ cheap_free(struct cheap *h, void *addr);
  */
 void *
 cheap_memalign(struct cheap *h, int alignment, size_t size);
-void *
-cheap_memalign_zero(struct cheap *h, int alignment, size_t size);
+
+/**
+ * cheap_reset() - rewind a cheap for reuse
+ * @h:      the cheap to reset
+ * @size:   number of bytes to keep (typically zero)
+ *
+ * Move the cursor back to @size bytes from the start of the cheap,
+ * keeping all of its pages resident so that the next round of
+ * allocations neither maps nor faults in memory.  Everything allocated
+ * beyond @size is implicitly freed.  In debug builds the first
+ * CHEAP_POISON_SZ bytes that will be handed out next are filled with
+ * 0xa5.
+ *
+ * A CHEAP_F_GROW cheap unmaps all but its current (largest) segment,
+ * and @size applies to that segment.  For an MT cheap the caller must
+ * ensure no thread is allocating; per-thread chunks are discarded.
+ */
+void
+cheap_reset(struct cheap *h, size_t size);
+
+/**
+ * cheap_mark() - record the current position of a cheap
+ * @h:  the cheap
+ *
+ * Return: an opaque mark that can later be passed to cheap_rewind().
+ */
+u_int64_t
+cheap_mark(struct cheap *h);
+
+/**
+ * cheap_rewind() - free everything allocated since a mark
+ * @h:      the cheap
+ * @mark:   a mark returned by cheap_mark()
+ *
+ * Marks nest to any depth: take a mark, allocate, take another mark,
+ * and so on, then rewind to any of them in O(1).  Rewinding to a mark
+ * invalidates all marks taken after it.  Pages stay resident, and (as
+ * for cheap_reset()) debug builds poison the start of the freed space.
+ *
+ * When the mark lies in an earlier segment of a CHEAP_F_GROW cheap,
+ * the newer segments are released, except for the largest, which is
+ * kept to satisfy the next growth.  For an MT cheap the caller must
+ * ensure no thread is allocating; per-thread chunks are discarded.
+ */
+void
+cheap_rewind(struct cheap *h, u_int64_t mark);
+
+/**
+ * cheap_trim() - release memory beyond a watermark back to the kernel
+ * @h:      the cheap to trim
+ * @rss:    number of bytes to keep resident
+ *
+ * Release the pages of @h above @rss bytes (rounded up to a page) that
+ * have been touched since creation or the last trim, using madvise().
+ * Memory that is still allocated is never released, so
+ * cheap_trim(h, 0) right after cheap_reset(h, 0) releases everything.
+ * Released pages read back as zero.  Heaps backed by a device or file
+ * are left alone.  For a CHEAP_F_GROW cheap this applies to the current
+ * segment.
+ */
+void
+cheap_trim(struct cheap *h, size_t rss);
 
 /**
  * cheap_used() - return number of bytes used
  * @h:  ptr to a cheap
  *
  * Return number of bytes used, including all padding incurred
- * by aligned allocations.
+ * by aligned allocations.  For a CHEAP_F_GROW cheap this includes
+ * the space used in every segment.
  */
 size_t
 cheap_used(struct cheap *h);
@@ -182,9 +978,23 @@ cheap_used(struct cheap *h);
  * cheap_avail() - return remaining free space
  * @h:  ptr to a cheap
  *
- * Calculate remaining free space in a cursor_heap (cheap).
+ * Calculate remaining free space in a cursor_heap (cheap).  For a
+ * CHEAP_F_GROW cheap this is the space left in the current segment,
+ * i.e. what can be allocated before the cheap grows again.
  */
 size_t
 cheap_avail(struct cheap *h);
 
+/**
+ * cheap_pagesize() - return the size of the pages backing a cheap
+ * @h:  ptr to a cheap
+ *
+ * Returns 1GiB or 2MiB for a cheap backed by explicit huge pages, the
+ * THP size for a CHEAP_F_THP cheap (when THP is enabled), and the base
+ * page size otherwise.  For a CHEAP_F_GROW cheap this describes the
+ * current segment.
+ */
+size_t
+cheap_pagesize(struct cheap *h);
+
 #endif /* HSE_PLATFORM_CURSOR_HEAP_H */
@@ -0,0 +1,441 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+/*
+ * C++ adapters for cursor heaps
+ *
+ * cheap_allocator<T> lets STL containers allocate from a cheap, and
+ * cheap_resource does the same for std::pmr containers.  Both allocate
+ * with cheap_memalign() at the alignment the container asks for, and both
+ * treat deallocation as a no-op: memory comes back all at once, when the
+ * cheap is reset (or rewound, or destroyed) - so the cheap must outlive
+ * the containers that use it, or at least their last access.
+ * cheap_new<T>() constructs a single object in a cheap.
+ *
+ * cheap_t<> owns a cheap whose alignment and thread safety are fixed in
+ * its type, so that its allocation fast path can be inlined and reduced
+ * to a handful of instructions.
+ */
+
+#ifndef HSE_PLATFORM_CURSOR_HEAP_HPP
+#define HSE_PLATFORM_CURSOR_HEAP_HPP
+
+#include <cerrno>
+#include <cstddef>
+#include <limits>
+#include <new>
+#include <stdexcept>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+#if __cplusplus >= 201703L && __has_include(<memory_resource>)
+#include <memory_resource>
+
+#define CHEAP_HAVE_PMR 1
+#endif
+
+extern "C" {
+#include "cursor_heap.h"
+}
+
+/**
+ * cheap_allocator - stateful std allocator that allocates from a cheap
+ *
+ * Copies (and rebinds) share the cheap, and compare equal if and only if
+ * they use the same cheap.  The allocator propagates on container copy,
+ * move and swap, so a container's elements always live in the cheap its
+ * allocator refers to.  allocate() throws std::bad_alloc when the cheap
+ * is full.
+ */
+template <class T>
+class cheap_allocator {
+  public:
+    using value_type = T;
+    using propagate_on_container_copy_assignment = std::true_type;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap = std::true_type;
+
+    explicit cheap_allocator(struct cheap *h) noexcept : h_(h) {}
+
+    template <class U>
+    cheap_allocator(const cheap_allocator<U> &other) noexcept : h_(other.heap())
+    {
+    }
+
+    T *
+    allocate(std::size_t n)
+    {
+        void *p;
+
+        if (n > std::numeric_limits<std::size_t>::max() / sizeof(T))
+            throw std::bad_array_new_length();
+
+        p = cheap_memalign(h_, alignof(T), n * sizeof(T));
+        if (!p)
+            throw std::bad_alloc();
+
+        return static_cast<T *>(p);
+    }
+
+    void
+    deallocate(T *, std::size_t) noexcept
+    {
+    }
+
+    struct cheap *
+    heap() const noexcept
+    {
+        return h_;
+    }
+
+  private:
+    struct cheap *h_;
+};
+
+template <class T, class U>
+inline bool
+operator==(const cheap_allocator<T> &a, const cheap_allocator<U> &b) noexcept
+{
+    return a.heap() == b.heap();
+}
+
+template <class T, class U>
+inline bool
+operator!=(const cheap_allocator<T> &a, const cheap_allocator<U> &b) noexcept
+{
+    return a.heap() != b.heap();
+}
+
+enum class cheap_threads { single, multi };
+
+enum class cheap_zeroing { none, zeroed };
+
+enum class cheap_backing { shared, private_anon, thp, huge_2m, huge_1g, dax };
+
+/**
+ * cheap_t - a cheap with its policies fixed at compile time
+ * @Alignment:  default allocation alignment (a power of 2 from 1 to 64)
+ * @Threads:    cheap_threads::multi for a CHEAP_F_MT cheap
+ * @Zeroing:    cheap_zeroing::zeroed for malloc() to zero (as calloc())
+ * @Backing:    the memory behind the cheap (anonymous shared or private,
+ *              THP, hugetlb, or a DAX device/file)
+ *
+ * cheap_t holds nothing but a struct cheap *, so get() can be passed to
+ * any of the C functions, and a struct cheap created by C code can be
+ * adopted (if its alignment and thread safety match the type).  The inline
+ * fast path handles an allocation at the default alignment that fits in
+ * the current segment; anything else (a full or growing cheap, thread
+ * caches, other alignments) goes to the C implementation.
+ */
+template <size_t Alignment = 8,
+          cheap_threads Threads = cheap_threads::single,
+          cheap_zeroing Zeroing = cheap_zeroing::none,
+          cheap_backing Backing = cheap_backing::shared>
+class cheap_t {
+    static_assert(Alignment >= 1 && Alignment <= 64 &&
+                      !(Alignment & (Alignment - 1)),
+                  "Alignment must be a power of 2 from 1 to 64");
+
+  public:
+    static constexpr bool mt = Threads == cheap_threads::multi;
+    static constexpr bool zeroed = Zeroing == cheap_zeroing::zeroed;
+
+    static constexpr u_int32_t flags =
+        (mt ? CHEAP_F_MT : 0) |
+        (Backing == cheap_backing::private_anon ? CHEAP_F_PRIVATE : 0) |
+        (Backing == cheap_backing::thp ? CHEAP_F_THP : 0) |
+        (Backing == cheap_backing::huge_2m ? CHEAP_F_HUGE_2M : 0) |
+        (Backing == cheap_backing::huge_1g ? CHEAP_F_HUGE_1G : 0);
+
+    /* Anonymous backings: @extra may add e.g. CHEAP_F_GROW */
+    template <cheap_backing B = Backing,
+              typename std::enable_if<B != cheap_backing::dax, int>::type = 0>
+    explicit cheap_t(size_t size, u_int32_t extra = 0)
+        : h_(cheap_create_flags(Alignment, size, flags | extra))
+    {
+        if (!h_)
+            throw std::bad_alloc();
+    }
+
+    /* DAX: all of @path, or [offset, offset + len) */
+    template <cheap_backing B = Backing,
+              typename std::enable_if<B == cheap_backing::dax, int>::type = 0>
+    explicit cheap_t(const char *path, off_t offset = 0, size_t len = 0)
+        : h_(cheap_create_dax_range(path, offset, len, Alignment))
+    {
+        static_assert(!mt, "DAX cheaps are single threaded");
+
+        if (!h_)
+            throw std::system_error(errno, std::generic_category(), path);
+    }
+
+    /* Adopt a cheap made by the C API */
+    explicit cheap_t(struct cheap *h) : h_(h)
+    {
+        if (!h || h->alignment != Alignment ||
+            !!(h->flags & CHEAP_F_MT) != mt)
+            throw std::invalid_argument("cheap policy mismatch");
+    }
+
+    cheap_t(const cheap_t &) = delete;
+    cheap_t &operator=(const cheap_t &) = delete;
+
+    cheap_t(cheap_t &&other) noexcept : h_(other.h_)
+    {
+        other.h_ = nullptr;
+    }
+
+    cheap_t &
+    operator=(cheap_t &&other) noexcept
+    {
+        std::swap(h_, other.h_);
+        return *this;
+    }
+
+    ~cheap_t()
+    {
+        cheap_destroy(h_);
+    }
+
+    struct cheap *
+    get() const noexcept
+    {
+        return h_;
+    }
+
+    /* Give up ownership, e.g. to hand the cheap to C code */
+    struct cheap *
+    release() noexcept
+    {
+        struct cheap *h = h_;
+
+        h_ = nullptr;
+        return h;
+    }
+
+    void *
+    malloc(size_t size)
+    {
+        void *p = mt ? alloc_mt(size) : alloc_st(size);
+
+        if (zeroed && p)
+            zero(p, size);
+
+        return p;
+    }
+
+    void *
+    calloc(size_t size)
+    {
+        return zeroed ? malloc(size) : cheap_calloc(h_, size);
+    }
+
+    void *
+    memalign(size_t alignment, size_t size)
+    {
+        return zeroed ? cheap_memalign_zero(h_, alignment, size)
+                      : cheap_memalign(h_, alignment, size);
+    }
+
+    void
+    free(void *p)
+    {
+        cheap_free(h_, p);
+    }
+
+    void
+    reset(size_t size = 0)
+    {
+        cheap_reset(h_, size);
+    }
+
+    size_t
+    used() const
+    {
+        return cheap_used(h_);
+    }
+
+    size_t
+    avail() const
+    {
+        return cheap_avail(h_);
+    }
+
+  private:
+    static constexpr u_int64_t
+    align_up(u_int64_t x)
+    {
+        return (x + Alignment - 1) & ~(u_int64_t)(Alignment - 1);
+    }
+
+    /* As in cheap_memalign_impl(), with the alignment a constant */
+    void *
+    alloc_st(size_t size)
+    {
+        u_int64_t allocp = align_up(h_->cursorp);
+
+        if (__builtin_expect(size <= h_->size &&
+                                 allocp - h_->base + size <= h_->size, 1)) {
+            h_->cursorp = allocp + size;
+            h_->lastp = allocp;
+            return (void *)allocp;
+        }
+
+        return slow(size);
+    }
+
+    /* As in cheap_memalign_atomic(), for cheaps without segments or
+     * thread caches.
+     */
+    void *
+    alloc_mt(size_t size)
+    {
+        u_int64_t sz = align_up(size), base = h_->base, oldp;
+
+        if (__builtin_expect(h_->seg || h_->tcpool || sz < size ||
+                                 sz > h_->size, 0))
+            return slow(size);
+
+        oldp = __atomic_fetch_add(&h_->cursorp, sz, __ATOMIC_RELAXED);
+        if (__builtin_expect(oldp >= base && oldp - base + sz <= h_->size, 1))
+            return (void *)oldp;
+
+        /* Overshot: give it back (if we still can), then let the slow
+         * path decide.
+         */
+        u_int64_t endp = oldp + sz;
+
+        __atomic_compare_exchange_n(&h_->cursorp, &endp, oldp, 0,
+                                    __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+
+        return slow(size);
+    }
+
+    /* Zeroing is done by malloc(), so the slow path never zeroes */
+    __attribute__((noinline)) void *
+    slow(size_t size)
+    {
+        return cheap_memalign(h_, Alignment, size);
+    }
+
+    /* As in cheap_zero_dirty() */
+    void
+    zero(void *p, size_t size)
+    {
+        u_int64_t addr = (u_int64_t)p, zbrk;
+
+        if (h_->seg) {
+            cheap_zero(p, size);
+            return;
+        }
+
+        if (mt)
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+        zbrk = __atomic_load_n(&h_->zbrk, __ATOMIC_ACQUIRE);
+        if (addr < zbrk)
+            cheap_zero(p, zbrk - addr < size ? zbrk - addr : size);
+    }
+
+    struct cheap *h_;
+};
+
+#if CHEAP_HAVE_PMR
+
+/**
+ * cheap_resource - std::pmr::memory_resource that allocates from a cheap
+ *
+ * Like std::pmr::monotonic_buffer_resource, but over a cheap (so it can be
+ * huge page, NUMA or DAX backed, and shared by several resources, or by
+ * threads if the cheap is CHEAP_F_MT).  Throws std::bad_alloc when the
+ * cheap is full rather than falling back to an upstream resource.
+ */
+class cheap_resource : public std::pmr::memory_resource {
+  public:
+    explicit cheap_resource(struct cheap *h) noexcept : h_(h) {}
+
+    struct cheap *
+    heap() const noexcept
+    {
+        return h_;
+    }
+
+  protected:
+    void *
+    do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+        void *p = cheap_memalign(h_, alignment, bytes);
+
+        if (!p)
+            throw std::bad_alloc();
+
+        return p;
+    }
+
+    void
+    do_deallocate(void *, std::size_t, std::size_t) override
+    {
+    }
+
+    bool
+    do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        auto *o = dynamic_cast<const cheap_resource *>(&other);
+
+        return o && o->h_ == h_;
+    }
+
+  private:
+    struct cheap *h_;
+};
+
+#endif
+
+/**
+ * cheap_new() - construct an object in a cheap
+ * @h:     the cheap from which to allocate
+ * @args:  arguments for T's constructor
+ *
+ * Allocates sizeof(T) bytes aligned to alignof(T) via cheap_memalign().
+ * If the constructor throws, the memory is given back (if it can be,
+ * see cheap_free()) and the exception propagates.
+ *
+ * Return: A pointer to the new object, or nullptr if the cheap is full.
+ */
+template <class T, class... Args>
+inline T *
+cheap_new(struct cheap *h, Args &&... args)
+{
+    void *p = cheap_memalign(h, alignof(T), sizeof(T));
+
+    if (!p)
+        return nullptr;
+
+    try {
+        return ::new (p) T(std::forward<Args>(args)...);
+    } catch (...) {
+        cheap_free(h, p);
+        throw;
+    }
+}
+
+/**
+ * cheap_delete() - destroy an object from cheap_new()
+ * @h:  the cheap it was allocated from
+ * @p:  the object (or nullptr)
+ *
+ * Runs the destructor, then cheap_free()s the memory, which is only
+ * reclaimed if it was the cheap's most recent allocation.
+ */
+template <class T>
+inline void
+cheap_delete(struct cheap *h, T *p)
+{
+    if (!p)
+        return;
+
+    p->~T();
+    cheap_free(h, p);
+}
+
+#endif
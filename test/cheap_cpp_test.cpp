@@ -0,0 +1,364 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <gtest/gtest.h>
+
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "cursor_heap.hpp"
+
+extern "C" {
+#include "cheap_testlib.h"
+#include <pthread.h>
+#include <unistd.h>
+}
+
+template <class T>
+static bool
+in_cheap(struct cheap *h, const T *p)
+{
+    return (u_int64_t)p >= h->base && (u_int64_t)(p + 1) <= h->base + h->size;
+}
+
+TEST(cheap_cpp_test, allocator_vector)
+{
+    struct cheap *h = cheap_create(8, 16ul << 20);
+    size_t        used;
+    int           i;
+
+    ASSERT_NE(0UL, (u_int64_t)h);
+
+    {
+        std::vector<u_int64_t, cheap_allocator<u_int64_t>> v{
+            cheap_allocator<u_int64_t>(h)
+        };
+
+        for (i = 0; i < 10000; ++i)
+            v.push_back(i);
+
+        ASSERT_TRUE(in_cheap(h, v.data()));
+        for (i = 0; i < 10000; ++i)
+            ASSERT_EQ((u_int64_t)i, v[i]);
+
+        used = cheap_used(h);
+        ASSERT_GE(used, 10000 * sizeof(u_int64_t));
+    }
+
+    /* Deallocation is a no-op */
+    ASSERT_EQ(used, cheap_used(h));
+
+    cheap_destroy(h);
+}
+
+TEST(cheap_cpp_test, allocator_rebind)
+{
+    struct cheap *h = cheap_create(8, 16ul << 20);
+    struct cheap *h2 = cheap_create(8, 1ul << 20);
+    int           i;
+
+    ASSERT_NE(0UL, (u_int64_t)h);
+    ASSERT_NE(0UL, (u_int64_t)h2);
+
+    using pair = std::pair<const int, std::string>;
+    cheap_allocator<pair> alloc(h);
+
+    /* Rebinding keeps the cheap, and equality follows it */
+    cheap_allocator<char> calloc_(alloc);
+    ASSERT_EQ(h, calloc_.heap());
+    ASSERT_TRUE(alloc == calloc_);
+    ASSERT_TRUE(alloc != cheap_allocator<char>(h2));
+
+    /* The containers must go before their cheap does */
+    {
+        std::map<int, std::string, std::less<int>, cheap_allocator<pair>> m(alloc);
+        std::unordered_map<int, int, std::hash<int>, std::equal_to<int>,
+                           cheap_allocator<std::pair<const int, int>>>
+            um(16, std::hash<int>(), std::equal_to<int>(),
+               cheap_allocator<std::pair<const int, int>>(h));
+
+        for (i = 0; i < 1000; ++i) {
+            m[i] = std::to_string(i);
+            um[i] = -i;
+        }
+
+        for (i = 0; i < 1000; ++i) {
+            ASSERT_EQ(std::to_string(i), m[i]);
+            ASSERT_EQ(-i, um[i]);
+            ASSERT_TRUE(in_cheap(h, &*m.find(i)));
+            ASSERT_TRUE(in_cheap(h, &*um.find(i)));
+        }
+    }
+
+    ASSERT_EQ(0UL, cheap_used(h2));
+
+    cheap_destroy(h2);
+    cheap_destroy(h);
+}
+
+TEST(cheap_cpp_test, allocator_full)
+{
+    struct cheap *h = cheap_create(8, 64ul << 10);
+
+    ASSERT_NE(0UL, (u_int64_t)h);
+
+    std::vector<char, cheap_allocator<char>> v{ cheap_allocator<char>(h) };
+
+    ASSERT_THROW(v.resize(cheap_avail(h) + 1), std::bad_alloc);
+
+    cheap_allocator<u_int64_t> alloc(h);
+    ASSERT_THROW(alloc.allocate(SIZE_MAX / 4), std::bad_array_new_length);
+
+    cheap_destroy(h);
+}
+
+#if CHEAP_HAVE_PMR
+
+TEST(cheap_cpp_test, resource)
+{
+    struct cheap *h = cheap_create(8, 16ul << 20);
+    struct cheap *h2 = cheap_create(8, 1ul << 20);
+    int           i;
+
+    ASSERT_NE(0UL, (u_int64_t)h);
+    ASSERT_NE(0UL, (u_int64_t)h2);
+
+    cheap_resource res(h), res_too(h), other(h2);
+
+    ASSERT_TRUE(res.is_equal(res_too));
+    ASSERT_FALSE(res.is_equal(other));
+    ASSERT_FALSE(res.is_equal(*std::pmr::new_delete_resource()));
+
+    {
+        std::pmr::vector<std::pmr::string> v(&res);
+
+        for (i = 0; i < 1000; ++i)
+            v.emplace_back(std::string(100, 'a' + i % 26));
+
+        ASSERT_TRUE(in_cheap(h, v.data()));
+        for (i = 0; i < 1000; ++i) {
+            ASSERT_TRUE(in_cheap(h, v[i].data()));
+            ASSERT_EQ(std::string(100, 'a' + i % 26), v[i].c_str());
+        }
+    }
+
+    /* Alignment is the caller's */
+    void *p = res.allocate(100, 256);
+    ASSERT_EQ(0UL, (u_int64_t)p % 256);
+
+    ASSERT_THROW((void)other.allocate(cheap_avail(h2) + 1), std::bad_alloc);
+
+    cheap_destroy(h2);
+    cheap_destroy(h);
+}
+
+#endif
+
+struct alignas(128) cheap_cpp_obj {
+    cheap_cpp_obj(int a, std::string b) : a(a), b(std::move(b)) {}
+
+    int         a;
+    std::string b;
+};
+
+struct cheap_cpp_throws {
+    cheap_cpp_throws() { throw std::runtime_error("nope"); }
+};
+
+TEST(cheap_cpp_test, cheap_new)
+{
+    struct cheap * h = cheap_create(8, 64ul << 10);
+    cheap_cpp_obj *o;
+    size_t         used;
+
+    ASSERT_NE(0UL, (u_int64_t)h);
+
+    /* Misalign the cursor first */
+    ASSERT_NE(0UL, (u_int64_t)cheap_malloc(h, 8));
+
+    o = cheap_new<cheap_cpp_obj>(h, 42, "forty-two");
+    ASSERT_NE(nullptr, o);
+    ASSERT_EQ(0UL, (u_int64_t)o % 128);
+    ASSERT_TRUE(in_cheap(h, o));
+    ASSERT_EQ(42, o->a);
+    ASSERT_EQ("forty-two", o->b);
+
+    /* Deleting the newest allocation gives its memory back */
+    used = cheap_used(h);
+    cheap_delete(h, o);
+    ASSERT_GT(used, cheap_used(h));
+    cheap_delete(h, (cheap_cpp_obj *)nullptr);
+
+    /* So does a throwing constructor */
+    used = cheap_used(h);
+    ASSERT_THROW(cheap_new<cheap_cpp_throws>(h), std::runtime_error);
+    ASSERT_EQ(used, cheap_used(h));
+
+    /* Full */
+    ASSERT_NE(0UL, (u_int64_t)cheap_malloc(h, cheap_avail(h)));
+    ASSERT_EQ(nullptr, cheap_new<int>(h, 1));
+
+    cheap_destroy(h);
+}
+
+TEST(cheap_cpp_test, cheap_t_st)
+{
+    cheap_t<16> h(4ul << 20);
+    char *      p, *q;
+
+    /* Nothing but the struct cheap */
+    ASSERT_EQ(sizeof(struct cheap *), sizeof(h));
+    ASSERT_EQ(16UL, h.get()->alignment);
+    ASSERT_EQ(0U, h.get()->flags & CHEAP_F_MT);
+
+    p = (char *)h.malloc(3);
+    q = (char *)h.malloc(5);
+    ASSERT_NE(nullptr, p);
+    ASSERT_EQ(p + 16, q);
+    ASSERT_EQ(0UL, (u_int64_t)q % 16);
+
+    /* Interleaves with the C API on the same cheap */
+    ASSERT_EQ(q + 16, (char *)cheap_malloc(h.get(), 1));
+    ASSERT_EQ(33UL, h.used());
+
+    /* free() of the last allocation, as cheap_free() */
+    p = (char *)h.malloc(100);
+    h.free(p);
+    ASSERT_EQ(p, (char *)h.malloc(100));
+
+    p = (char *)h.memalign(4096, 1);
+    ASSERT_EQ(0UL, (u_int64_t)p % 4096);
+
+    /* Full (the cursor is 1 past a page, so 15 bytes go to alignment) */
+    ASSERT_EQ(nullptr, h.malloc(h.avail() + 1));
+    ASSERT_NE(nullptr, h.malloc(h.avail() & ~15ul));
+    ASSERT_EQ(nullptr, h.malloc(1));
+
+    h.reset();
+    ASSERT_EQ(0UL, h.used());
+}
+
+TEST(cheap_cpp_test, cheap_t_grow)
+{
+    cheap_t<8> h(2ul << 20, CHEAP_F_GROW);
+    size_t     i;
+
+    /* The slow path grows the cheap */
+    for (i = 0; i < 8; ++i)
+        ASSERT_NE(nullptr, h.malloc(1ul << 20));
+
+    ASSERT_EQ(8ul << 20, h.used());
+}
+
+static void *
+cheap_t_mt_worker(void *rock)
+{
+    auto *h = (cheap_t<16, cheap_threads::multi> *)rock;
+    int   i;
+
+    for (i = 0; i < 10000; ++i) {
+        u_int64_t *p = (u_int64_t *)h->malloc(sizeof(*p) * 2);
+
+        if (!p || (u_int64_t)p % 16)
+            return (void *)1;
+        p[0] = p[1] = (u_int64_t)p;
+    }
+
+    return NULL;
+}
+
+TEST(cheap_cpp_test, cheap_t_mt)
+{
+    cheap_t<16, cheap_threads::multi> h(4ul << 20);
+    pthread_t                         tidv[4];
+    void *                            rc;
+    int                               i;
+
+    ASSERT_NE(0U, h.get()->flags & CHEAP_F_MT);
+
+    for (i = 0; i < 4; ++i)
+        ASSERT_EQ(0, pthread_create(&tidv[i], NULL, cheap_t_mt_worker, &h));
+
+    for (i = 0; i < 4; ++i) {
+        ASSERT_EQ(0, pthread_join(tidv[i], &rc));
+        ASSERT_EQ(nullptr, rc);
+    }
+
+    /* No two allocations overlapped */
+    ASSERT_EQ(4UL * 10000 * 16, h.used());
+    for (u_int64_t *p = (u_int64_t *)h.get()->base;
+         p < (u_int64_t *)h.get()->cursorp; p += 2)
+        ASSERT_EQ((u_int64_t)p, p[0] | p[1]);
+
+    /* Overshooting the end leaves the cursor where it was */
+    ASSERT_EQ(nullptr, h.malloc(h.avail() + 16));
+    ASSERT_EQ(4UL * 10000 * 16, h.used());
+}
+
+TEST(cheap_cpp_test, cheap_t_zeroed)
+{
+    cheap_t<8, cheap_threads::single, cheap_zeroing::zeroed> h(4ul << 20);
+    char *p;
+    int   i;
+
+    p = (char *)h.malloc(8192);
+    ASSERT_NE(nullptr, p);
+    memset(p, 0xa5, 8192);
+
+    /* The memory comes back dirty, and malloc() zeroes it */
+    h.reset();
+    p = (char *)h.malloc(8192);
+    for (i = 0; i < 8192; ++i)
+        ASSERT_EQ(0, p[i]);
+
+    p = (char *)h.memalign(64, 100);
+    ASSERT_EQ(0UL, (u_int64_t)p % 64);
+}
+
+TEST(cheap_cpp_test, cheap_t_adopt)
+{
+    struct cheap *h = cheap_create_mt(16, 4ul << 20);
+
+    ASSERT_NE(0UL, (u_int64_t)h);
+
+    ASSERT_THROW(cheap_t<16>{ h }, std::invalid_argument);
+    ASSERT_THROW((cheap_t<8, cheap_threads::multi>{ h }), std::invalid_argument);
+
+    cheap_t<16, cheap_threads::multi> t(h);
+    ASSERT_EQ(h, t.get());
+    ASSERT_NE(nullptr, t.malloc(10));
+
+    cheap_t<16, cheap_threads::multi> moved(std::move(t));
+    ASSERT_EQ(nullptr, t.get());
+    ASSERT_EQ(h, moved.release());
+
+    cheap_destroy(h);
+}
+
+TEST(cheap_cpp_test, cheap_t_dax)
+{
+    char path[] = "/tmp/cheap_cpp_test.XXXXXX";
+    int  fd;
+
+    fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(0, ftruncate(fd, 1ul << 20));
+    close(fd);
+
+    {
+        cheap_t<64, cheap_threads::single, cheap_zeroing::none,
+                cheap_backing::dax>
+            h(path, PAGE_SIZE);
+
+        ASSERT_EQ((1ul << 20) - PAGE_SIZE, h.avail());
+        ASSERT_NE(nullptr, h.malloc(100));
+    }
+
+    ASSERT_THROW((cheap_t<64, cheap_threads::single, cheap_zeroing::none,
+                          cheap_backing::dax>("/nonexistent/dax")),
+                 std::system_error);
+
+    unlink(path);
+}
@@ -0,0 +1,634 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "cheap_testlib.h"
+#include "cursor_heap.h"
+#include "cheap_dax.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+}
+
+/* A regular file stands in for the DAX device: cheap_create_dax_range()
+ * maps it the same way, just at page rather than 2MiB granularity.
+ */
+
+#define DAX_FILE_SZ     (16ul << 20)
+
+static void
+dax_file_create(char *path, size_t pathsz, size_t size)
+{
+    int fd;
+
+    snprintf(path, pathsz, "/tmp/cheap_dax_test.XXXXXX");
+    fd = mkstemp(path);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(0, ftruncate(fd, size));
+    close(fd);
+}
+
+TEST(cheap_dax_test, align)
+{
+    char   path[64];
+    size_t align = 0;
+
+    dax_file_create(path, sizeof(path), DAX_FILE_SZ);
+
+    ASSERT_EQ(0, cheap_devdax_get_align(path, &align));
+    ASSERT_EQ((size_t)PAGE_SIZE, align);
+
+    ASSERT_EQ(-ENOENT, cheap_devdax_get_align("/nonexistent/dax", &align));
+
+    unlink(path);
+}
+
+TEST(cheap_dax_test, range_invalid)
+{
+    char          path[64];
+    struct cheap *h;
+
+    dax_file_create(path, sizeof(path), DAX_FILE_SZ);
+
+    /* Misaligned offset, misaligned length */
+    h = cheap_create_dax_range(path, 100, PAGE_SIZE, 8);
+    ASSERT_EQ(0UL, (u_int64_t)h);
+    ASSERT_EQ(EINVAL, errno);
+
+    h = cheap_create_dax_range(path, 0, PAGE_SIZE + 1, 8);
+    ASSERT_EQ(0UL, (u_int64_t)h);
+    ASSERT_EQ(EINVAL, errno);
+
+    /* Past the end, or running off it */
+    h = cheap_create_dax_range(path, DAX_FILE_SZ, 0, 8);
+    ASSERT_EQ(0UL, (u_int64_t)h);
+    ASSERT_EQ(EINVAL, errno);
+
+    h = cheap_create_dax_range(path, DAX_FILE_SZ - PAGE_SIZE,
+                               2 * PAGE_SIZE, 8);
+    ASSERT_EQ(0UL, (u_int64_t)h);
+    ASSERT_EQ(EINVAL, errno);
+
+    h = cheap_create_dax_range(path, -PAGE_SIZE, PAGE_SIZE, 8);
+    ASSERT_EQ(0UL, (u_int64_t)h);
+    ASSERT_EQ(EINVAL, errno);
+
+    h = cheap_create_dax_range("/nonexistent/dax", 0, 0, 8);
+    ASSERT_EQ(0UL, (u_int64_t)h);
+    ASSERT_EQ(ENOENT, errno);
+
+    unlink(path);
+}
+
+TEST(cheap_dax_test, range_rest)
+{
+    char          path[64];
+    struct cheap *h;
+    size_t        off = 4 * PAGE_SIZE;
+
+    dax_file_create(path, sizeof(path), DAX_FILE_SZ);
+
+    /* len 0 is everything from the offset on */
+    h = cheap_create_dax_range(path, off, 0, 8);
+    ASSERT_NE(0UL, (u_int64_t)h);
+    ASSERT_EQ(DAX_FILE_SZ - off, h->size);
+    ASSERT_EQ(DAX_FILE_SZ - off, cheap_avail(h));
+
+    ASSERT_NE(0UL, (u_int64_t)cheap_malloc(h, DAX_FILE_SZ - off));
+    ASSERT_EQ(0UL, (u_int64_t)cheap_malloc(h, 1));
+
+    cheap_destroy(h);
+    unlink(path);
+}
+
+TEST(cheap_dax_test, range_odd_size)
+{
+    char          path[64];
+    struct cheap *h;
+    size_t        off = 4 * PAGE_SIZE;
+
+    /* Not a whole number of pages: len 0 stops at the last full one */
+    dax_file_create(path, sizeof(path), DAX_FILE_SZ + 100);
+
+    h = cheap_create_dax_range(path, off, 0, 8);
+    ASSERT_NE(0UL, (u_int64_t)h);
+    ASSERT_EQ(DAX_FILE_SZ - off, h->size);
+    cheap_destroy(h);
+
+    /* Explicit lengths must still be whole pages */
+    h = cheap_create_dax_range(path, 0, DAX_FILE_SZ + 100, 8);
+    ASSERT_EQ(0UL, (u_int64_t)h);
+    ASSERT_EQ(EINVAL, errno);
+
+    h = cheap_format_dax(path, 8);
+    ASSERT_NE(0UL, (u_int64_t)h);
+    ASSERT_EQ(DAX_FILE_SZ - PAGE_SIZE, cheap_avail(h));
+    cheap_destroy(h);
+
+    h = cheap_open_dax(path);
+    ASSERT_NE(0UL, (u_int64_t)h);
+    ASSERT_EQ(DAX_FILE_SZ - PAGE_SIZE, cheap_avail(h));
+    cheap_destroy(h);
+
+    unlink(path);
+
+    /* Less than one page is too small to map at all */
+    dax_file_create(path, sizeof(path), 100);
+
+    h = cheap_create_dax_range(path, 0, 0, 8);
+    ASSERT_EQ(0UL, (u_int64_t)h);
+    ASSERT_EQ(EINVAL, errno);
+
+    unlink(path);
+}
+
+TEST(cheap_dax_test, range_shards)
+{
+    char          path[64];
+    struct cheap *hv[4];
+    size_t        shardsz = DAX_FILE_SZ / 4;
+    char         *buf, *p;
+    int           fd, i;
+
+    dax_file_create(path, sizeof(path), DAX_FILE_SZ);
+
+    for (i = 0; i < 4; ++i) {
+        hv[i] = cheap_create_dax_range(path, i * shardsz, shardsz, 8);
+        ASSERT_NE(0UL, (u_int64_t)hv[i]);
+        ASSERT_EQ(shardsz, cheap_avail(hv[i]));
+    }
+
+    /* Fill each shard with its own pattern */
+    for (i = 0; i < 4; ++i) {
+        p = (char *)cheap_malloc(hv[i], shardsz);
+        ASSERT_NE(0UL, (u_int64_t)p);
+        memset(p, 'a' + i, shardsz);
+        ASSERT_EQ(0UL, (u_int64_t)cheap_malloc(hv[i], 1));
+    }
+
+    for (i = 0; i < 4; ++i)
+        cheap_destroy(hv[i]);
+
+    /* Each shard landed in its own range of the file */
+    buf = (char *)malloc(shardsz);
+    ASSERT_NE(0UL, (u_int64_t)buf);
+
+    fd = open(path, O_RDONLY);
+    ASSERT_GE(fd, 0);
+
+    for (i = 0; i < 4; ++i) {
+        ASSERT_EQ((ssize_t)shardsz, pread(fd, buf, shardsz, i * shardsz));
+        ASSERT_EQ(buf[0], 'a' + i);
+        ASSERT_EQ(buf[shardsz - 1], 'a' + i);
+        ASSERT_EQ(0, memcmp(buf, buf + 1, shardsz - 1));
+    }
+
+    close(fd);
+    free(buf);
+    unlink(path);
+}
+
+struct dax_node {
+    u_int64_t next;     /* cheap_off() of the next node */
+    u_int64_t val;
+};
+
+TEST(cheap_dax_test, persist_reopen)
+{
+    char             path[64];
+    struct cheap *   h;
+    struct dax_node *n, *prev = NULL;
+    u_int64_t *      root, head;
+    void *           oldmem, *block;
+    size_t           used;
+    int              i;
+
+    dax_file_create(path, sizeof(path), DAX_FILE_SZ);
+
+    h = cheap_format_dax(path, 16);
+    ASSERT_NE(0UL, (u_int64_t)h);
+    ASSERT_EQ(16UL, h->alignment);
+    ASSERT_EQ(DAX_FILE_SZ - PAGE_SIZE, cheap_avail(h));
+
+    /* A root slot, then a linked list of nodes that refer to each other
+     * by offset.
+     */
+    root = (u_int64_t *)cheap_malloc(h, sizeof(*root));
+    ASSERT_NE(0UL, (u_int64_t)root);
+    ASSERT_NE(0UL, cheap_off(h, root));
+    ASSERT_EQ(root, cheap_ptr(h, cheap_off(h, root)));
+    ASSERT_EQ(0UL, cheap_off(h, NULL));
+    ASSERT_EQ(NULL, cheap_ptr(h, 0));
+
+    for (i = 0; i < 1000; ++i) {
+        n = (struct dax_node *)cheap_malloc(h, sizeof(*n));
+        ASSERT_NE(0UL, (u_int64_t)n);
+        n->val = i;
+        n->next = 0;
+        if (prev)
+            prev->next = cheap_off(h, n);
+        else
+            *root = cheap_off(h, n);
+        prev = n;
+    }
+
+    used = cheap_used(h);
+    oldmem = h->hdr;
+    ASSERT_EQ(0, cheap_sync(h));
+    cheap_destroy(h);
+
+    /* Make sure the heap can't land where it was */
+    block = mmap(oldmem, PAGE_SIZE, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS,
+                 -1, 0);
+    ASSERT_NE(MAP_FAILED, block);
+
+    h = cheap_open_dax(path);
+    ASSERT_NE(0UL, (u_int64_t)h);
+    ASSERT_NE(oldmem, (void *)h->hdr);
+    ASSERT_EQ(16UL, h->alignment);
+    ASSERT_EQ(used, cheap_used(h));
+
+    /* The root is the first allocation, so it's at the base */
+    root = (u_int64_t *)h->base;
+    head = *root;
+    for (i = 0, n = (struct dax_node *)cheap_ptr(h, head); n;
+         n = (struct dax_node *)cheap_ptr(h, n->next), ++i)
+        ASSERT_EQ((u_int64_t)i, n->val);
+    ASSERT_EQ(1000, i);
+
+    /* Allocation picks up where it left off */
+    n = (struct dax_node *)cheap_malloc(h, sizeof(*n));
+    ASSERT_NE(0UL, (u_int64_t)n);
+    ASSERT_EQ(used + sizeof(*n), cheap_used(h));
+    ASSERT_GE(cheap_off(h, n), cheap_off(h, root) + used);
+
+    cheap_destroy(h);
+    munmap(block, PAGE_SIZE);
+
+    /* cheap_destroy() recorded the last allocation */
+    h = cheap_open_dax(path);
+    ASSERT_NE(0UL, (u_int64_t)h);
+    ASSERT_EQ(used + sizeof(*n), cheap_used(h));
+    cheap_destroy(h);
+
+    unlink(path);
+}
+
+/* Memory handed out again below the synced cursor (after a rewind, reset
+ * or free) must be persisted by the next cheap_sync().
+ */
+TEST(cheap_dax_test, persist_rewind)
+{
+    char          path[64];
+    struct cheap *h;
+    u_int64_t     mark, *p;
+    size_t        used;
+    int           i;
+
+    dax_file_create(path, sizeof(path), DAX_FILE_SZ);
+
+    h = cheap_format_dax(path, 8);
+    ASSERT_NE(0UL, (u_int64_t)h);
+
+    mark = cheap_mark(h);
+    for (i = 0; i < 512; ++i) {
+        p = (u_int64_t *)cheap_malloc(h, sizeof(*p));
+        ASSERT_NE(0UL, (u_int64_t)p);
+        *p = i;
+    }
+    ASSERT_EQ(0, cheap_sync(h));
+    ASSERT_EQ(h->cursorp, h->synclow);
+
+    /* Rewind below the synced cursor, then write less than before */
+    cheap_rewind(h, mark);
+    ASSERT_EQ(mark, h->synclow);
+
+    for (i = 0; i < 256; ++i) {
+        p = (u_int64_t *)cheap_malloc(h, sizeof(*p));
+        ASSERT_NE(0UL, (u_int64_t)p);
+        *p = 1000 + i;
+    }
+    used = cheap_used(h);
+    ASSERT_EQ(0, cheap_sync(h));
+    ASSERT_EQ(h->cursorp, h->synclow);
+
+    /* Likewise after cheap_free() of the last allocation */
+    p = (u_int64_t *)cheap_malloc(h, sizeof(*p));
+    ASSERT_NE(0UL, (u_int64_t)p);
+    ASSERT_EQ(0, cheap_sync(h));
+    cheap_free(h, p);
+    ASSERT_EQ((u_int64_t)p, h->synclow);
+    ASSERT_EQ(0, cheap_sync(h));
+    cheap_destroy(h);
+
+    h = cheap_open_dax(path);
+    ASSERT_NE(0UL, (u_int64_t)h);
+    ASSERT_EQ(used, cheap_used(h));
+
+    p = (u_int64_t *)h->base;
+    for (i = 0; i < 256; ++i)
+        ASSERT_EQ((u_int64_t)(1000 + i), p[i]);
+
+    cheap_destroy(h);
+    unlink(path);
+}
+
+TEST(cheap_dax_test, persist_invalid)
+{
+    char                 path[64];
+    struct cheap_dax_hdr hdr;
+    struct cheap *       h;
+    int                  fd;
+
+    dax_file_create(path, sizeof(path), DAX_FILE_SZ);
+
+    /* Never formatted */
+    h = cheap_open_dax(path);
+    ASSERT_EQ(0UL, (u_int64_t)h);
+    ASSERT_EQ(EINVAL, errno);
+
+    h = cheap_open_dax("/nonexistent/dax");
+    ASSERT_EQ(0UL, (u_int64_t)h);
+    ASSERT_EQ(ENOENT, errno);
+
+    /* Bad alignment */
+    h = cheap_format_dax(path, 3);
+    ASSERT_EQ(0UL, (u_int64_t)h);
+    ASSERT_EQ(EINVAL, errno);
+
+    /* Not persistent */
+    h = cheap_create_dax_range(path, 0, 0, 8);
+    ASSERT_NE(0UL, (u_int64_t)h);
+    ASSERT_EQ(-EINVAL, cheap_sync(h));
+    cheap_destroy(h);
+
+    h = cheap_format_dax(path, 8);
+    ASSERT_NE(0UL, (u_int64_t)h);
+    cheap_destroy(h);
+
+    /* A cursor past the end of the heap */
+    fd = open(path, O_RDWR);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ((ssize_t)sizeof(hdr), pread(fd, &hdr, sizeof(hdr), 0));
+    hdr.cursor = hdr.size + 1;
+    ASSERT_EQ((ssize_t)sizeof(hdr), pwrite(fd, &hdr, sizeof(hdr), 0));
+
+    h = cheap_open_dax(path);
+    ASSERT_EQ(0UL, (u_int64_t)h);
+    ASSERT_EQ(EINVAL, errno);
+
+    /* A heap bigger than the file */
+    hdr.cursor = hdr.base;
+    hdr.size = DAX_FILE_SZ * 2;
+    ASSERT_EQ((ssize_t)sizeof(hdr), pwrite(fd, &hdr, sizeof(hdr), 0));
+
+    h = cheap_open_dax(path);
+    ASSERT_EQ(0UL, (u_int64_t)h);
+    ASSERT_EQ(EINVAL, errno);
+
+    close(fd);
+    unlink(path);
+}
+
+TEST(cheap_dax_test, flush)
+{
+    const char *namev[] = { "clwb", "clflushopt", "clflush" };
+    char        buf[3 * CL_SIZE + 5];
+    int         i, rc;
+
+    ASSERT_EQ(-EINVAL, cheap_flush_select("bogus"));
+
+    for (i = 0; i < 3; ++i) {
+        rc = cheap_flush_select(namev[i]);
+        ASSERT_TRUE(rc == 0 || rc == -ENOTSUP);
+        if (rc)
+            continue;
+
+        ASSERT_STREQ(namev[i], cheap_flush_isa());
+
+        /* Unaligned, spanning several lines; the data is unchanged */
+        memset(buf, 'x', sizeof(buf));
+        cheap_flush(buf + 3, sizeof(buf) - 3);
+        cheap_flush(buf, 0);
+        ASSERT_EQ(buf[0], 'x');
+        ASSERT_EQ(0, memcmp(buf, buf + 1, sizeof(buf) - 1));
+    }
+
+    ASSERT_EQ(0, cheap_flush_select(NULL));
+    ASSERT_NE(0UL, (u_int64_t)cheap_flush_isa());
+}
+
+TEST(cheap_dax_test, persist)
+{
+    char          path[64], val;
+    struct cheap *h;
+    char *        p;
+    int           fd;
+
+    /* Nothing to persist an anonymous cheap to */
+    h = cheap_create(8, 1ul << 20);
+    ASSERT_NE(0UL, (u_int64_t)h);
+    p = (char *)cheap_malloc(h, 100);
+    ASSERT_EQ(-EINVAL, cheap_persist(h, p, 100));
+    cheap_destroy(h);
+
+    dax_file_create(path, sizeof(path), DAX_FILE_SZ);
+
+    h = cheap_format_dax(path, 8);
+    ASSERT_NE(0UL, (u_int64_t)h);
+
+    /* Not a DAX filesystem, so this is msync() (and unaligned is fine) */
+    p = (char *)cheap_malloc(h, 3 * PAGE_SIZE);
+    ASSERT_NE(0UL, (u_int64_t)p);
+    memset(p, 'p', 3 * PAGE_SIZE);
+    ASSERT_EQ(0, cheap_persist(h, p + 100, 2 * PAGE_SIZE));
+
+    fd = open(path, O_RDONLY);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(1, pread(fd, &val, 1, cheap_off(h, p) + PAGE_SIZE));
+    ASSERT_EQ('p', val);
+
+    /* The recorded cursor covers exactly what was allocated */
+    ASSERT_EQ(0, cheap_sync(h));
+    ASSERT_EQ(h->cursorp - (u_int64_t)h->hdr, h->hdr->cursor);
+
+    /* A cursor moved back is recorded too */
+    cheap_reset(h, 0);
+    ASSERT_EQ(0, cheap_sync(h));
+    ASSERT_EQ(h->hdr->base, h->hdr->cursor);
+
+    close(fd);
+    cheap_destroy(h);
+    unlink(path);
+}
+
+/* Check that @fd holds @len bytes of @c at @off */
+static void
+dax_file_check(int fd, off_t off, size_t len, char c)
+{
+    char   buf[PAGE_SIZE];
+    size_t i, n;
+
+    for (; len > 0; len -= n, off += n) {
+        n = len < sizeof(buf) ? len : sizeof(buf);
+        ASSERT_EQ((ssize_t)n, pread(fd, buf, n, off));
+        for (i = 0; i < n; i += CL_SIZE)
+            ASSERT_EQ(c, buf[i]) << "off " << off + i;
+    }
+}
+
+TEST(cheap_dax_test, multi)
+{
+    size_t        sizev[3] = { 4ul << 20, 8ul << 20, (5ul << 20) + 100 };
+    char          pathv[3][64];
+    const char *  paths[3];
+    struct cheap *h;
+    size_t        total = 0, off;
+    char *        p;
+    int           fd, i;
+
+    for (i = 0; i < 3; ++i) {
+        dax_file_create(pathv[i], sizeof(pathv[i]), sizev[i]);
+        paths[i] = pathv[i];
+        total += sizev[i] & PAGE_MASK;
+    }
+
+    h = cheap_create_dax_multi(paths, 3, 8);
+    ASSERT_NE(0UL, (u_int64_t)h);
+    ASSERT_EQ(total, cheap_avail(h));
+
+    /* One allocation spanning all three */
+    p = (char *)cheap_malloc(h, total);
+    ASSERT_NE(0UL, (u_int64_t)p);
+    ASSERT_EQ(0UL, (u_int64_t)cheap_malloc(h, 1));
+
+    for (i = 0, off = 0; i < 3; off += sizev[i] & PAGE_MASK, ++i)
+        memset(p + off, 'a' + i, sizev[i] & PAGE_MASK);
+
+    cheap_destroy(h);
+
+    for (i = 0; i < 3; ++i) {
+        fd = open(paths[i], O_RDONLY);
+        ASSERT_GE(fd, 0);
+        dax_file_check(fd, 0, sizev[i] & PAGE_MASK, 'a' + i);
+        close(fd);
+        unlink(paths[i]);
+    }
+}
+
+TEST(cheap_dax_test, striped)
+{
+    size_t        sizev[3] = { 4ul << 20, 6ul << 20, 4ul << 20 };
+    size_t        stripe = 64ul << 10;
+    char          pathv[3][64];
+    const char *  paths[3];
+    struct cheap *h;
+    size_t        off;
+    char *        p;
+    int           fd, i;
+
+    for (i = 0; i < 3; ++i) {
+        dax_file_create(pathv[i], sizeof(pathv[i]), sizev[i]);
+        paths[i] = pathv[i];
+    }
+
+    /* The stripe must be whole pages, and fit in every device */
+    h = cheap_create_dax_striped(paths, 3, 0, 8);
+    ASSERT_EQ(0UL, (u_int64_t)h);
+    ASSERT_EQ(EINVAL, errno);
+
+    h = cheap_create_dax_striped(paths, 3, PAGE_SIZE + 512, 8);
+    ASSERT_EQ(0UL, (u_int64_t)h);
+    ASSERT_EQ(EINVAL, errno);
+
+    h = cheap_create_dax_striped(paths, 3, 8ul << 20, 8);
+    ASSERT_EQ(0UL, (u_int64_t)h);
+    ASSERT_EQ(EINVAL, errno);
+
+    /* The smallest device limits each one's share */
+    h = cheap_create_dax_striped(paths, 3, stripe, 8);
+    ASSERT_NE(0UL, (u_int64_t)h);
+    ASSERT_EQ(3 * (4ul << 20), cheap_avail(h));
+
+    p = (char *)cheap_malloc(h, cheap_avail(h));
+    ASSERT_NE(0UL, (u_int64_t)p);
+
+    /* Stripe k goes to device k % 3 */
+    for (off = 0; off < h->size; off += stripe)
+        memset(p + off, 'a' + (off / stripe) % 3, stripe);
+
+    cheap_destroy(h);
+
+    for (i = 0; i < 3; ++i) {
+        fd = open(paths[i], O_RDONLY);
+        ASSERT_GE(fd, 0);
+        dax_file_check(fd, 0, 4ul << 20, 'a' + i);
+        dax_file_check(fd, 4ul << 20, sizev[i] - (4ul << 20), 0);
+        close(fd);
+        unlink(paths[i]);
+    }
+}
+
+TEST(cheap_dax_test, multi_invalid)
+{
+    const char *  paths[2];
+    char          path[64];
+    struct cheap *h;
+
+    dax_file_create(path, sizeof(path), DAX_FILE_SZ);
+    paths[0] = path;
+    paths[1] = "/nonexistent/dax";
+
+    h = cheap_create_dax_multi(paths, 0, 8);
+    ASSERT_EQ(0UL, (u_int64_t)h);
+    ASSERT_EQ(EINVAL, errno);
+
+    h = cheap_create_dax_multi(paths, 2, 8);
+    ASSERT_EQ(0UL, (u_int64_t)h);
+    ASSERT_EQ(ENOENT, errno);
+
+    /* A device too small to map any of */
+    ASSERT_EQ(0, truncate(path, 100));
+    h = cheap_create_dax_multi(paths, 1, 8);
+    ASSERT_EQ(0UL, (u_int64_t)h);
+    ASSERT_EQ(EINVAL, errno);
+
+    unlink(path);
+}
+
+/* Devices are laid out back to back, each at a multiple of its own
+ * alignment (there's no devdax here, so lay out made-up devices).
+ */
+TEST(cheap_dax_test, multi_mixed_align)
+{
+    struct cheap_dax_dev devv[3] = {};
+    size_t               total = 0;
+
+    /* 2MiB devdax, then a file, then another 2MiB devdax */
+    devv[0].size = 4ul << 20;
+    devv[0].align = 2ul << 20;
+    devv[1].size = 2ul << 20;
+    devv[1].align = PAGE_SIZE;
+    devv[2].size = 2ul << 20;
+    devv[2].align = 2ul << 20;
+
+    ASSERT_EQ(0, cheap_dax_concat(devv, 3, &total));
+    ASSERT_EQ(8ul << 20, total);
+    ASSERT_EQ(0UL, devv[0].off);
+    ASSERT_EQ(4ul << 20, devv[1].off);
+    ASSERT_EQ(6ul << 20, devv[2].off);
+
+    /* A file that isn't a whole number of 2MiB leaves the devdax after
+     * it misaligned.
+     */
+    devv[1].size = PAGE_SIZE;
+    ASSERT_EQ(-EINVAL, cheap_dax_concat(devv, 3, &total));
+
+    /* ... which is fine with the devdax first */
+    ASSERT_EQ(0, cheap_dax_concat(devv, 2, &total));
+    ASSERT_EQ((4ul << 20) + PAGE_SIZE, total);
+}
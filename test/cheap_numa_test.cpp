@@ -0,0 +1,351 @@
+/* SPDX-License-Identifier: Apache-2.0 */
+
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "cheap_testlib.h"
+#include "cursor_heap.h"
+#include "cheap_numa.h"
+#include <errno.h>
+#include <string.h>
+#include <sched.h>
+#include <pthread.h>
+}
+
+/* These run on any machine: node 0 always exists, and a node beyond
+ * the highest possible node never does.
+ */
+
+TEST(cheap_numa_test, max_node)
+{
+    int maxnode = cheap_numa_max_node();
+
+    ASSERT_GE(maxnode, 0);
+    ASSERT_LT(maxnode, CHEAP_NUMA_NODES_MAX);
+}
+
+TEST(cheap_numa_test, invalid_policy)
+{
+    struct cheap_numa_policy policy = {};
+    struct cheap *           h;
+
+    policy.mode = CHEAP_NUMA_BIND;
+    policy.nodemask = 0;
+    h = cheap_create_numa(8, 4ul << 20, &policy);
+    ASSERT_EQ(0UL, (u_int64_t)h);
+    ASSERT_EQ(EINVAL, errno);
+
+    /* Preferred takes exactly one node */
+    policy.mode = CHEAP_NUMA_PREFERRED;
+    policy.nodemask = 3;
+    h = cheap_create_numa(8, 4ul << 20, &policy);
+    ASSERT_EQ(0UL, (u_int64_t)h);
+    ASSERT_EQ(EINVAL, errno);
+
+    policy.mode = (enum cheap_numa_mode)0;
+    policy.nodemask = 1;
+    h = cheap_create_numa(8, 4ul << 20, &policy);
+    ASSERT_EQ(0UL, (u_int64_t)h);
+
+    if (cheap_numa_max_node() < CHEAP_NUMA_NODES_MAX - 1) {
+        policy.mode = CHEAP_NUMA_BIND;
+        policy.nodemask = 1ul << (CHEAP_NUMA_NODES_MAX - 1);
+        h = cheap_create_numa(8, 4ul << 20, &policy);
+        ASSERT_EQ(0UL, (u_int64_t)h);
+    }
+}
+
+static void
+numa_check(enum cheap_numa_mode mode, u_int32_t flags)
+{
+    struct cheap_numa_policy policy = {};
+    struct cheap *           h;
+    size_t                   bytesv[CHEAP_NUMA_NODES_MAX];
+    size_t                   sz = 8ul << 20;
+    ssize_t                  total;
+    void *                   p;
+
+    policy.mode = mode;
+    policy.nodemask = 1;
+    policy.flags = flags;
+
+    h = cheap_create_numa(8, sz, &policy);
+    ASSERT_NE(0UL, (u_int64_t)h);
+
+    total = cheap_numa_stat(h, bytesv, CHEAP_NUMA_NODES_MAX);
+    ASSERT_EQ(0, total);
+
+    p = cheap_malloc(h, sz / 2);
+    ASSERT_NE(0UL, (u_int64_t)p);
+    memset(p, 0xa5, sz / 2);
+
+    total = cheap_numa_stat(h, bytesv, CHEAP_NUMA_NODES_MAX);
+    ASSERT_GE(total, (ssize_t)(sz / 2));
+    ASSERT_EQ((size_t)total, bytesv[0]);
+
+    cheap_destroy(h);
+}
+
+TEST(cheap_numa_test, bind)
+{
+    numa_check(CHEAP_NUMA_BIND, 0);
+    numa_check(CHEAP_NUMA_BIND, CHEAP_F_PRIVATE);
+    numa_check(CHEAP_NUMA_BIND, CHEAP_F_HUGE_2M);
+}
+
+TEST(cheap_numa_test, preferred)
+{
+    numa_check(CHEAP_NUMA_PREFERRED, 0);
+    numa_check(CHEAP_NUMA_PREFERRED, CHEAP_F_MT);
+}
+
+TEST(cheap_numa_test, interleave)
+{
+    numa_check(CHEAP_NUMA_INTERLEAVE, 0);
+    numa_check(CHEAP_NUMA_INTERLEAVE, CHEAP_F_THP);
+}
+
+TEST(cheap_numa_test, populate)
+{
+    struct cheap_numa_policy policy = {};
+    struct cheap *           h;
+    size_t                   bytesv[CHEAP_NUMA_NODES_MAX];
+
+    /* The policy is in place before the pages are faulted in */
+    policy.mode = CHEAP_NUMA_BIND;
+    policy.nodemask = 1;
+    policy.flags = CHEAP_F_POPULATE;
+
+    h = cheap_create_numa(8, 8ul << 20, &policy);
+    ASSERT_NE(0UL, (u_int64_t)h);
+    ASSERT_TRUE(h->flags & CHEAP_F_POPULATE);
+
+    ASSERT_EQ((ssize_t)h->size, cheap_numa_stat(h, bytesv, CHEAP_NUMA_NODES_MAX));
+    ASSERT_EQ(h->size, bytesv[0]);
+
+    cheap_destroy(h);
+}
+
+TEST(cheap_numa_test, grow)
+{
+    struct cheap_numa_policy policy = {};
+    struct cheap *           h;
+    size_t                   bytesv[CHEAP_NUMA_NODES_MAX];
+    ssize_t                  total;
+    void *                   p;
+    int                      i;
+
+    policy.mode = CHEAP_NUMA_BIND;
+    policy.nodemask = 1;
+    policy.flags = CHEAP_F_GROW;
+
+    h = cheap_create_numa(8, 2ul << 20, &policy);
+    ASSERT_NE(0UL, (u_int64_t)h);
+
+    for (i = 0; i < 64; ++i) {
+        p = cheap_malloc(h, 65536);
+        ASSERT_NE(0UL, (u_int64_t)p);
+        memset(p, i, 65536);
+    }
+    ASSERT_NE(0UL, (u_int64_t)h->seg->next);
+
+    /* Residency covers every segment */
+    total = cheap_numa_stat(h, bytesv, CHEAP_NUMA_NODES_MAX);
+    ASSERT_GE(total, 64 * 65536L);
+    ASSERT_EQ((size_t)total, bytesv[0]);
+
+    cheap_destroy(h);
+}
+
+TEST(cheap_numa_test, stat_plain)
+{
+    struct cheap *h;
+    size_t        bytesv[1];
+    void *        p;
+
+    h = cheap_create(8, 4ul << 20);
+    ASSERT_NE(0UL, (u_int64_t)h);
+
+    p = cheap_malloc(h, 1ul << 20);
+    memset(p, 1, 1ul << 20);
+
+    ASSERT_GE(cheap_numa_stat(h, bytesv, 1), 1L << 20);
+
+    cheap_destroy(h);
+}
+
+TEST(cheap_numa_test, list_read)
+{
+    u_int8_t bitv[8] = {};
+
+    /* Every machine has a cpu 0 and a node 0 */
+    ASSERT_GE(cheap_numa_list_read("/sys/devices/system/cpu/online", bitv, 8), 0);
+    ASSERT_EQ(1, bitv[0]);
+
+    ASSERT_EQ(-ENOENT, cheap_numa_list_read("/nonexistent", bitv, 8));
+}
+
+TEST(cheap_numa_test, set_create)
+{
+    struct cheap_set *set;
+    struct cheap *    h;
+    void *            p;
+    int               node;
+
+    set = cheap_set_create(8, 4ul << 20, 0);
+    ASSERT_NE(0UL, (u_int64_t)set);
+    ASSERT_EQ(cheap_numa_max_node() + 1, set->nnodes);
+
+    for (node = 0; node < set->nnodes; ++node) {
+        h = cheap_set_heap(set, node);
+        ASSERT_NE(0UL, (u_int64_t)h);
+        ASSERT_TRUE(h->flags & CHEAP_F_MT);
+    }
+
+    /* This thread's allocations come from its own node's cheap */
+    h = cheap_set_local(set);
+    p = cheap_set_malloc(set, 100);
+    ASSERT_NE(0UL, (u_int64_t)p);
+    ASSERT_GE((u_int64_t)p, h->base);
+    ASSERT_LT((u_int64_t)p, h->base + h->size);
+
+    p = cheap_set_memalign(set, 4096, 100);
+    ASSERT_EQ(0UL, (u_int64_t)p & 4095);
+
+    ASSERT_GE(cheap_set_used(set), 200UL);
+
+    cheap_set_destroy(set);
+    cheap_set_destroy(NULL);
+}
+
+/* Pretend to have three nodes, with CPUs dealt round-robin */
+static void
+set_fake_topo(struct cheap_topo *topo, int *cpu_node, int ncpus)
+{
+    int cpu;
+
+    for (cpu = 0; cpu < ncpus; ++cpu)
+        cpu_node[cpu] = cpu % 3;
+
+    topo->nnodes = 3;
+    topo->ncpus = ncpus;
+    topo->cpu_node = cpu_node;
+}
+
+TEST(cheap_numa_test, set_fake_topo)
+{
+    struct cheap_topo topo;
+    struct cheap_set *set;
+    struct cheap *    h;
+    int               cpu_node[256];
+    int               ncpus = 256;
+    int               cpu;
+    cpu_set_t         mask, omask;
+    void *            p;
+
+    set_fake_topo(&topo, cpu_node, ncpus);
+
+    set = cheap_set_create_topo(8, 4ul << 20, 0, &topo);
+    ASSERT_NE(0UL, (u_int64_t)set);
+    ASSERT_EQ(3, set->nnodes);
+
+    /* Pin ourselves so that we know which node we're on */
+    cpu = sched_getcpu();
+    ASSERT_GE(cpu, 0);
+    ASSERT_LT(cpu, ncpus);
+    ASSERT_EQ(0, sched_getaffinity(0, sizeof(omask), &omask));
+    CPU_ZERO(&mask);
+    CPU_SET(cpu, &mask);
+    ASSERT_EQ(0, sched_setaffinity(0, sizeof(mask), &mask));
+
+    h = cheap_set_local(set);
+    ASSERT_EQ(cheap_set_heap(set, cpu % 3), h);
+
+    p = cheap_set_malloc(set, 1000);
+    ASSERT_GE((u_int64_t)p, h->base);
+    ASSERT_LT((u_int64_t)p, h->base + h->size);
+    ASSERT_EQ(1000UL, cheap_used(h));
+    ASSERT_EQ(1000UL, cheap_set_used(set));
+
+    ASSERT_EQ(0, sched_setaffinity(0, sizeof(omask), &omask));
+
+    cheap_set_destroy(set);
+
+    /* Out of range nodes in the map are routed to node 0 */
+    cpu_node[cpu] = 7;
+    set = cheap_set_create_topo(8, 4ul << 20, 0, &topo);
+    ASSERT_NE(0UL, (u_int64_t)set);
+    ASSERT_EQ(0, set->cpu_node[cpu]);
+    cheap_set_destroy(set);
+
+    topo.nnodes = 0;
+    ASSERT_EQ(0UL, (u_int64_t)cheap_set_create_topo(8, 4ul << 20, 0, &topo));
+}
+
+struct set_worker_args {
+    struct cheap_set *set;
+    int               nallocs;
+    int               err;
+};
+
+static void *
+set_worker(void *rock)
+{
+    struct set_worker_args *args = (struct set_worker_args *)rock;
+    struct cheap *          h;
+    u_int64_t *             p;
+    int                     i, node;
+
+    for (i = 0; i < args->nallocs; ++i) {
+        p = (u_int64_t *)cheap_set_malloc(args->set, 64);
+        if (!p) {
+            args->err = ENOMEM;
+            break;
+        }
+        *p = (u_int64_t)p;
+
+        /* Threads may migrate, but p must be in one of the set's cheaps */
+        for (node = 0; node < args->set->nnodes; ++node) {
+            h = cheap_set_heap(args->set, node);
+            if ((u_int64_t)p >= h->base && (u_int64_t)p < h->base + h->size)
+                break;
+        }
+        if (node == args->set->nnodes) {
+            args->err = EINVAL;
+            break;
+        }
+    }
+
+    return NULL;
+}
+
+TEST(cheap_numa_test, set_concurrent)
+{
+    struct set_worker_args args[8];
+    pthread_t              tidv[8];
+    struct cheap_topo      topo;
+    struct cheap_set *     set;
+    int                    cpu_node[256];
+    int                    i;
+
+    set_fake_topo(&topo, cpu_node, 256);
+
+    set = cheap_set_create_topo(8, 16ul << 20, 0, &topo);
+    ASSERT_NE(0UL, (u_int64_t)set);
+
+    for (i = 0; i < 8; ++i) {
+        args[i].set = set;
+        args[i].nallocs = 10000;
+        args[i].err = 0;
+        ASSERT_EQ(0, pthread_create(&tidv[i], NULL, set_worker, &args[i]));
+    }
+
+    for (i = 0; i < 8; ++i) {
+        pthread_join(tidv[i], NULL);
+        ASSERT_EQ(0, args[i].err);
+    }
+
+    ASSERT_EQ(8 * 10000 * 64UL, cheap_set_used(set));
+
+    cheap_set_destroy(set);
+}
@@ -11,13 +11,21 @@
 
 extern "C" {
 #include "cheap_testlib.h"
+#include "xrand.h"
 #include "cursor_heap.h"
 #include "cheap_dax.h"
 #include "minmax.h"
 #include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/wait.h>
 #include <sys/mman.h>
 }
 
+#include <algorithm>
+#include <vector>
+
 /* Create a pool with invalid alignment (not power of 2) */
 TEST(cursor_heap, invalidcreate1)
 {
@@ -222,7 +230,7 @@ TEST(cheap_test, cheap_test_used)
     cheap_destroy(h);
 }
 
-#if 0
+#if CHEAP_POISON_SZ > 0
 /* Test that cheap_reset() poisons the memory that would
  * be given out by the next call to cheap_malloc().
  *
@@ -239,7 +247,7 @@ TEST(cheap_test, cheap_test_poison)
     h = cheap_create(0, CHEAP_POISON_SZ * 4);
     ASSERT_NE(0UL, (u_int64_t)h);
 
-    p = cheap_malloc(h, CHEAP_POISON_SZ * 2);
+    p = (u_int8_t *)cheap_malloc(h, CHEAP_POISON_SZ * 2);
     ASSERT_NE(0UL, (u_int64_t)p);
 
     for (i = 0; i < CHEAP_POISON_SZ; ++i)
@@ -248,7 +256,7 @@ TEST(cheap_test, cheap_test_poison)
     cheap_reset(h, CHEAP_POISON_SZ);
 
     for (i = 0; i < CHEAP_POISON_SZ; ++i) {
-        ASSERT_EQ(i, p[i]);
+        ASSERT_EQ((u_int8_t)i, p[i]);
         ASSERT_EQ(0xa5, p[i + CHEAP_POISON_SZ]);
     }
 
@@ -401,8 +409,7 @@ rss(void *mem, size_t maxpg, unsigned char *vec)
     return sz;
 }
 
-#if 0
-/* Verify cheap_trim() works as expected. */
+/* Verify cheap_reset() and cheap_trim() work as expected. */
 TEST(cheap_test, cheap_test_trim)
 {
     size_t        maxpg = 256;
@@ -410,19 +417,20 @@ TEST(cheap_test, cheap_test_trim)
     size_t        sz;
     struct cheap *h;
     uintptr_t     p;
-    int           i;
+    size_t        i;
 
     h = cheap_create(0, maxpg * PAGE_SIZE);
     ASSERT_NE(0UL, (u_int64_t)h);
 
-    /* After create at least one page should be resident.
+    /* The metadata doesn't live in the cheap, so after create
+     * nothing should be resident.
      */
-    sz = rss(h, maxpg, vec);
-    ASSERT_GE(sz, PAGE_SIZE);
+    sz = rss(h->mem, maxpg, vec);
+    ASSERT_EQ(sz, 0);
 
-    for (i = 0; i < maxpg - 1; ++i) {
-        p = cheap_memalign(h, PAGE_SIZE, 8);
-        ASSERT_NE(NULL, p);
+    for (i = 0; i < maxpg; ++i) {
+        p = (uintptr_t)cheap_memalign(h, PAGE_SIZE, 8);
+        ASSERT_NE(0UL, p);
         ASSERT_TRUE(IS_ALIGNED((uintptr_t)p, PAGE_SIZE));
 
         *(int *)p = i;
@@ -431,22 +439,27 @@ TEST(cheap_test, cheap_test_trim)
     /* After allocating and touching all pages they all
      * should be resident.
      */
-    sz = rss(h, maxpg, vec);
+    sz = rss(h->mem, maxpg, vec);
+    ASSERT_EQ(sz, maxpg * PAGE_SIZE);
+
+    /* Trim doesn't release memory that is still allocated.
+     */
+    cheap_trim(h, 0);
+    sz = rss(h->mem, maxpg, vec);
     ASSERT_EQ(sz, maxpg * PAGE_SIZE);
 
     cheap_reset(h, 0);
+    ASSERT_EQ(0, cheap_used(h));
 
     /* After reset all pages should still be resident.
      */
-    sz = rss(h, maxpg, vec);
+    sz = rss(h->mem, maxpg, vec);
     ASSERT_EQ(sz, maxpg * PAGE_SIZE);
 
-#if MADV_FREE == MADV_DONTNEED
-
     /* Trim one page.
      */
     cheap_trim(h, (maxpg - 1) * PAGE_SIZE);
-    sz = rss(h, maxpg, vec);
+    sz = rss(h->mem, maxpg, vec);
     ASSERT_EQ(sz, (maxpg - 1) * PAGE_SIZE);
     ASSERT_EQ(0, vec[maxpg - 1] & 0x01);
 
@@ -454,7 +467,7 @@ TEST(cheap_test, cheap_test_trim)
      * are resident.
      */
     cheap_trim(h, (maxpg / 2) * PAGE_SIZE);
-    sz = rss(h, maxpg, vec);
+    sz = rss(h->mem, maxpg, vec);
     ASSERT_EQ(sz, (maxpg / 2) * PAGE_SIZE);
     ASSERT_EQ(0, vec[maxpg / 2] & 0x01);
 
@@ -462,7 +475,7 @@ TEST(cheap_test, cheap_test_trim)
      * are still resident.
      */
     cheap_trim(h, (maxpg / 2) * PAGE_SIZE);
-    sz = rss(h, maxpg, vec);
+    sz = rss(h->mem, maxpg, vec);
     ASSERT_EQ(sz, (maxpg / 2) * PAGE_SIZE);
     ASSERT_EQ(0, vec[maxpg / 2] & 0x01);
 
@@ -470,7 +483,7 @@ TEST(cheap_test, cheap_test_trim)
      * of the pages are resident.
      */
     cheap_trim(h, (maxpg / 4) * PAGE_SIZE);
-    sz = rss(h, maxpg, vec);
+    sz = rss(h->mem, maxpg, vec);
     ASSERT_EQ(sz, (maxpg / 4) * PAGE_SIZE);
     ASSERT_EQ(0, vec[maxpg / 4] & 0x01);
 
@@ -478,28 +491,1257 @@ TEST(cheap_test, cheap_test_trim)
      * of the pages are still resident.
      */
     cheap_trim(h, (maxpg / 2) * PAGE_SIZE);
-    sz = rss(h, maxpg, vec);
+    sz = rss(h->mem, maxpg, vec);
     ASSERT_EQ(sz, (maxpg / 4) * PAGE_SIZE);
     ASSERT_EQ(0, vec[maxpg / 4] & 0x01);
 
-    /* Trim to zero, then check that at most one page is resident.
+    /* Pages below the watermark keep their contents.
+     */
+    ASSERT_EQ(1, *(int *)((u_int8_t *)h->mem + PAGE_SIZE));
+
+    /* Trim to zero, then check that no pages are resident.
      */
     cheap_trim(h, 0);
-    sz = rss(h, maxpg, vec);
-    ASSERT_EQ(sz, PAGE_SIZE);
-    ASSERT_EQ(1, vec[0] & 0x01);
+    sz = rss(h->mem, maxpg, vec);
+    ASSERT_EQ(sz, 0);
+    ASSERT_EQ(0, vec[0] & 0x01);
 
-    /* Trim to half, then check that at most one page is resident.
+    /* Trim to half, then check that still no pages are resident.
      */
     cheap_trim(h, (maxpg / 2) * PAGE_SIZE);
-    sz = rss(h, maxpg, vec);
-    ASSERT_EQ(sz, PAGE_SIZE);
-    ASSERT_EQ(1, vec[0] & 0x01);
+    sz = rss(h->mem, maxpg, vec);
+    ASSERT_EQ(sz, 0);
 
-#endif
+    /* Released pages read back as zero.
+     */
+    for (i = 0; i < 2; ++i) {
+        p = (uintptr_t)cheap_memalign(h, PAGE_SIZE, 8);
+        ASSERT_NE(0UL, p);
+        ASSERT_EQ(0, *(int *)p);
+    }
+
+    cheap_destroy(h);
+}
+
+/* A reset growable cheap keeps only its largest segment */
+TEST(cheap_test, grow_reset)
+{
+    struct cheap *h;
+    void *        p;
+    size_t        size;
+    int           i;
+
+    h = cheap_create_flags(8, 2ul << 20, CHEAP_F_GROW);
+    ASSERT_NE(0UL, (u_int64_t)h);
+
+    for (i = 0; i < 100; ++i) {
+        p = cheap_malloc(h, 65536);
+        ASSERT_NE(0UL, (u_int64_t)p);
+    }
+    ASSERT_NE(0UL, (u_int64_t)h->seg->next);
+    size = h->size;
+
+    cheap_reset(h, 0);
+    ASSERT_EQ(0UL, (u_int64_t)h->seg->next);
+    ASSERT_EQ(0, cheap_used(h));
+    ASSERT_EQ(size, cheap_avail(h));
+
+    p = cheap_malloc(h, 8);
+    ASSERT_EQ(h->base, (u_int64_t)p);
+
+    cheap_destroy(h);
+}
+
+/* Fill and verify an MT cheap from a single thread */
+TEST(cheap_test, mt_verify_test1)
+{
+    int           rc;
+    size_t        total = 104857600;
+    struct cheap *h = 0;
+
+    h = cheap_create_mt(8, total);
+    ASSERT_NE(0UL, (u_int64_t)h);
+    ASSERT_TRUE(h->flags & CHEAP_F_MT);
+
+    rc = cheap_verify_test1(h, 4, 8192);
+    ASSERT_EQ(0, rc);
+    cheap_destroy(h);
+}
+
+/* Unknown flags are rejected */
+TEST(cheap_test, mt_invalid_flags)
+{
+    struct cheap *h;
+
+    h = cheap_create_flags(8, 1048576, ~CHEAP_F_MASK);
+    ASSERT_EQ(0UL, (u_int64_t)h);
+}
+
+#define MT_THREADS  8
+#define MT_ALLOCS   (16 * 1024)
+
+struct mt_arg {
+    struct cheap *h;
+    int           idx;
+    int           nallocs;
+    uintptr_t     addr[MT_ALLOCS];
+    size_t        size[MT_ALLOCS];
+};
+
+static void *
+mt_worker(void *rock)
+{
+    struct mt_arg *arg = (struct mt_arg *)rock;
+    struct xrand   xr;
+    int            i;
+
+    xrand_init(&xr, arg->idx + 1);
+
+    for (i = 0; i < MT_ALLOCS; ++i) {
+        size_t sz = xrand_range64(&xr, 1, 512);
+        void  *p;
+
+        /* Mix in some over-aligned requests to exercise the cmpxchg path */
+        if (i % 7 == 0)
+            p = cheap_memalign(arg->h, 256, sz);
+        else
+            p = cheap_malloc(arg->h, sz);
+        if (!p)
+            break;
+
+        memset(p, arg->idx, sz);
+        arg->addr[i] = (uintptr_t)p;
+        arg->size[i] = sz;
+    }
+    arg->nallocs = i;
+
+    return NULL;
+}
+
+/* Allocate concurrently from many threads until the cheap is exhausted,
+ * then verify that no two allocations overlap and that every allocation
+ * still holds the pattern written by its owner.
+ */
+static void
+mt_concurrent_check(struct cheap *h)
+{
+    static struct mt_arg argv[MT_THREADS];
+    pthread_t            tidv[MT_THREADS];
+    std::vector<std::pair<uintptr_t, size_t>> allocs;
+    size_t               total = 0;
+    int                  i, j, rc;
+
+    for (i = 0; i < MT_THREADS; ++i) {
+        argv[i].h = h;
+        argv[i].idx = i;
+        rc = pthread_create(&tidv[i], NULL, mt_worker, &argv[i]);
+        ASSERT_EQ(0, rc);
+    }
+
+    for (i = 0; i < MT_THREADS; ++i)
+        pthread_join(tidv[i], NULL);
+
+    for (i = 0; i < MT_THREADS; ++i) {
+        for (j = 0; j < argv[i].nallocs; ++j) {
+            u_int8_t *p = (u_int8_t *)argv[i].addr[j];
+
+            ASSERT_TRUE(IS_ALIGNED(argv[i].addr[j], h->alignment));
+            ASSERT_EQ((u_int8_t)i, p[0]);
+            ASSERT_EQ((u_int8_t)i, p[argv[i].size[j] - 1]);
+
+            allocs.push_back(std::make_pair(argv[i].addr[j], argv[i].size[j]));
+            total += argv[i].size[j];
+        }
+    }
+
+    std::sort(allocs.begin(), allocs.end());
+    for (i = 1; i < (int)allocs.size(); ++i)
+        ASSERT_LE(allocs[i - 1].first + allocs[i - 1].second, allocs[i].first);
+
+    ASSERT_LE(total, cheap_used(h));
+
+    if (!(h->flags & CHEAP_F_GROW)) {
+        ASSERT_LE(cheap_used(h), h->size);
+        ASSERT_EQ(h->size - cheap_used(h), cheap_avail(h));
+    }
+}
+
+TEST(cheap_test, mt_concurrent)
+{
+    struct cheap *h;
+
+    /* Small enough that the threads run it out of space */
+    h = cheap_create_mt(16, 16ul << 20);
+    ASSERT_NE(0UL, (u_int64_t)h);
+
+    mt_concurrent_check(h);
+
+    cheap_destroy(h);
+}
+
+TEST(cheap_test, tcache_concurrent)
+{
+    struct cheap *h;
+    int           rc;
+
+    h = cheap_create_mt(16, 16ul << 20);
+    ASSERT_NE(0UL, (u_int64_t)h);
+
+    rc = cheap_tcache_enable(h, 64 * 1024);
+    ASSERT_EQ(0, rc);
+
+    mt_concurrent_check(h);
+
+    cheap_destroy(h);
+}
+
+TEST(cheap_test, tcache_invalid)
+{
+    struct cheap *h;
+
+    h = cheap_create(8, 1048576);
+    ASSERT_NE(0UL, (u_int64_t)h);
+    ASSERT_EQ(-EINVAL, cheap_tcache_enable(h, 0));
+    cheap_destroy(h);
+
+    h = cheap_create_mt(8, 1048576);
+    ASSERT_NE(0UL, (u_int64_t)h);
+    ASSERT_EQ(-EINVAL, cheap_tcache_enable(h, 64ul << 20));
+    ASSERT_EQ(0, cheap_tcache_enable(h, 0));
+    ASSERT_EQ(-EINVAL, cheap_tcache_enable(h, 0));
+    cheap_destroy(h);
+}
+
+/* Space parked in a thread's chunk is not counted as used */
+TEST(cheap_test, tcache_used)
+{
+    struct cheap *h;
+    void *        p;
+    int           rc;
+
+    h = cheap_create_mt(8, 1048576);
+    ASSERT_NE(0UL, (u_int64_t)h);
+
+    rc = cheap_tcache_enable(h, 64 * 1024);
+    ASSERT_EQ(0, rc);
+
+    p = cheap_malloc(h, 100);
+    ASSERT_NE(0UL, (u_int64_t)p);
+    ASSERT_EQ(h->base + 64 * 1024, h->cursorp);
+    ASSERT_EQ(104, cheap_used(h));
+    ASSERT_EQ(h->size - 104, cheap_avail(h));
+
+    cheap_tcache_flush(h);
+    ASSERT_EQ(h->base + 104, h->cursorp);
+    ASSERT_EQ(104, cheap_used(h));
+
+    /* Requests too big for a chunk come straight from the cheap */
+    p = cheap_malloc(h, 32 * 1024);
+    ASSERT_EQ(h->base + 104, (u_int64_t)p);
+    ASSERT_EQ(h->base + 104 + 32 * 1024, h->cursorp);
+
+    cheap_destroy(h);
+}
+
+static void *
+tcache_exit_worker(void *rock)
+{
+    return cheap_malloc((struct cheap *)rock, 100);
+}
+
+/* A thread's unused chunk tail is returned when the thread exits */
+TEST(cheap_test, tcache_thread_exit)
+{
+    struct cheap *h;
+    pthread_t     tid;
+    void *        p;
+    int           rc;
+
+    h = cheap_create_mt(8, 1048576);
+    ASSERT_NE(0UL, (u_int64_t)h);
+
+    rc = cheap_tcache_enable(h, 64 * 1024);
+    ASSERT_EQ(0, rc);
+
+    rc = pthread_create(&tid, NULL, tcache_exit_worker, h);
+    ASSERT_EQ(0, rc);
+    pthread_join(tid, &p);
+
+    ASSERT_EQ(h->base, (u_int64_t)p);
+    ASSERT_EQ(h->base + 104, h->cursorp);
+    ASSERT_EQ(104, cheap_used(h));
+
+    cheap_destroy(h);
+}
+
+/* A growable cheap keeps allocating past its initial size */
+TEST(cheap_test, grow_fill)
+{
+    struct cheap *    h;
+    struct cheap_seg *seg;
+    size_t            sz = 65536;
+    u_int8_t *        bufv[1024];
+    int               i, nsegs;
+
+    h = cheap_create_flags(8, 2ul << 20, CHEAP_F_GROW);
+    ASSERT_NE(0UL, (u_int64_t)h);
+
+    for (i = 0; i < 1024; ++i) {
+        bufv[i] = (u_int8_t *)cheap_malloc(h, sz);
+        ASSERT_NE(0UL, (u_int64_t)bufv[i]);
+        memset(bufv[i], i, sz);
+    }
+
+    ASSERT_EQ(1024 * sz, cheap_used(h));
+
+    for (i = 0; i < 1024; ++i) {
+        ASSERT_EQ((u_int8_t)i, bufv[i][0]);
+        ASSERT_EQ((u_int8_t)i, bufv[i][sz - 1]);
+    }
+
+    /* 64MiB from segments of 2, 4, 8, 16, 32, and 64MiB */
+    nsegs = 0;
+    for (seg = h->seg; seg; seg = seg->next) {
+        if (seg->next) {
+            ASSERT_EQ(seg->size, seg->next->size * 2);
+        }
+        ++nsegs;
+    }
+    ASSERT_EQ(6, nsegs);
+    ASSERT_EQ(h->size - (cheap_used(h) - h->retired), cheap_avail(h));
+
+    cheap_destroy(h);
+}
+
+/* An allocation larger than the next geometric step gets a segment
+ * big enough to hold it.
+ */
+TEST(cheap_test, grow_large)
+{
+    struct cheap *h;
+    size_t        sz = 10ul << 20;
+    void *        p;
+
+    h = cheap_create(8, 2ul << 20);
+    ASSERT_NE(0UL, (u_int64_t)h);
+    p = cheap_malloc(h, sz);
+    ASSERT_EQ(0UL, (u_int64_t)p);
+    cheap_destroy(h);
+
+    h = cheap_create_flags(8, 2ul << 20, CHEAP_F_GROW);
+    ASSERT_NE(0UL, (u_int64_t)h);
+
+    p = cheap_malloc(h, 100);
+    ASSERT_NE(0UL, (u_int64_t)p);
+
+    p = cheap_memalign(h, 4096, sz);
+    ASSERT_NE(0UL, (u_int64_t)p);
+    ASSERT_TRUE(IS_ALIGNED((u_int64_t)p, 4096));
+    ASSERT_GE(h->size, sz);
+    memset(p, 0xff, sz);
+
+    ASSERT_EQ(100 + sz, cheap_used(h));
+
+    cheap_destroy(h);
+}
+
+TEST(cheap_test, grow_mt_concurrent)
+{
+    struct cheap *h;
+
+    h = cheap_create_flags(16, 2ul << 20, CHEAP_F_MT | CHEAP_F_GROW);
+    ASSERT_NE(0UL, (u_int64_t)h);
+
+    mt_concurrent_check(h);
+    ASSERT_NE(0UL, (u_int64_t)h->seg->next);
+
+    cheap_destroy(h);
+}
+
+TEST(cheap_test, grow_tcache_concurrent)
+{
+    struct cheap *h;
+    int           rc;
+
+    h = cheap_create_flags(16, 2ul << 20, CHEAP_F_MT | CHEAP_F_GROW);
+    ASSERT_NE(0UL, (u_int64_t)h);
+
+    rc = cheap_tcache_enable(h, 64 * 1024);
+    ASSERT_EQ(0, rc);
+
+    mt_concurrent_check(h);
+    ASSERT_NE(0UL, (u_int64_t)h->seg->next);
+
+    cheap_destroy(h);
+}
+
+/* A reset MT cheap discards per-thread chunks */
+TEST(cheap_test, tcache_reset)
+{
+    struct cheap *h;
+    void *        p;
+    int           rc;
+
+    h = cheap_create_mt(8, 1048576);
+    ASSERT_NE(0UL, (u_int64_t)h);
+
+    rc = cheap_tcache_enable(h, 64 * 1024);
+    ASSERT_EQ(0, rc);
+
+    p = cheap_malloc(h, 100);
+    ASSERT_EQ(h->base, (u_int64_t)p);
+    p = cheap_malloc(h, 100);
+    ASSERT_EQ(h->base + 104, (u_int64_t)p);
+
+    cheap_reset(h, 0);
+    ASSERT_EQ(0, cheap_used(h));
+
+    p = cheap_malloc(h, 100);
+    ASSERT_EQ(h->base, (u_int64_t)p);
+    ASSERT_EQ(104, cheap_used(h));
+
+    cheap_destroy(h);
+}
+
+/* Marks nest, and rewinding to one frees everything allocated after it */
+TEST(cheap_test, mark_rewind)
+{
+    struct cheap *h;
+    u_int64_t     markv[8];
+    u_int8_t *    p;
+    int           i, j;
+
+    h = cheap_create(8, 1048576);
+    ASSERT_NE(0UL, (u_int64_t)h);
+
+    p = (u_int8_t *)cheap_malloc(h, 104);
+    ASSERT_NE(0UL, (u_int64_t)p);
+    memset(p, 0x42, 104);
+
+    for (i = 0; i < 8; ++i) {
+        markv[i] = cheap_mark(h);
+        ASSERT_EQ(h->cursorp, markv[i]);
+
+        for (j = 0; j < 100; ++j)
+            ASSERT_NE(0UL, (u_int64_t)cheap_malloc(h, 1000));
+    }
+
+    for (i = 7; i >= 4; --i) {
+        cheap_rewind(h, markv[i]);
+        ASSERT_EQ(markv[i], h->cursorp);
+        ASSERT_EQ(markv[i] - h->base, cheap_used(h));
+    }
+
+    /* Rewinding straight to an outer mark skips the inner ones */
+    cheap_rewind(h, markv[0]);
+    ASSERT_EQ(104, cheap_used(h));
+    ASSERT_EQ(markv[0], (u_int64_t)cheap_malloc(h, 8));
+
+    for (i = 0; i < 104; ++i)
+        ASSERT_EQ(0x42, p[i]);
+
+    cheap_destroy(h);
+}
+
+/* Rewinding across segments of a growable cheap */
+TEST(cheap_test, grow_mark_rewind)
+{
+    struct cheap *h;
+    u_int64_t     mark0, mark1;
+    void *        spare;
+    int           i, j;
+
+    h = cheap_create_flags(8, 2ul << 20, CHEAP_F_GROW);
+    ASSERT_NE(0UL, (u_int64_t)h);
+
+    ASSERT_NE(0UL, (u_int64_t)cheap_malloc(h, 104));
+    mark0 = cheap_mark(h);
+
+    for (i = 0; i < 40; ++i)
+        ASSERT_NE(0UL, (u_int64_t)cheap_malloc(h, 65536));
+    ASSERT_NE(0UL, (u_int64_t)h->seg->next);
+
+    mark1 = cheap_mark(h);
+    for (i = 0; i < 200; ++i)
+        ASSERT_NE(0UL, (u_int64_t)cheap_malloc(h, 65536));
+
+    cheap_rewind(h, mark1);
+    ASSERT_EQ(mark1, h->cursorp);
+    ASSERT_EQ(104 + 40 * 65536, cheap_used(h));
+
+    cheap_rewind(h, mark0);
+    ASSERT_EQ(0UL, (u_int64_t)h->seg->next);
+    ASSERT_EQ(104, cheap_used(h));
+    ASSERT_NE(0UL, (u_int64_t)h->spare);
+
+    /* A request loop reuses the spare rather than mapping anew */
+    spare = h->spare->mem;
+    for (j = 0; j < 3; ++j) {
+        for (i = 0; i < 40; ++i)
+            ASSERT_NE(0UL, (u_int64_t)cheap_malloc(h, 65536));
+        ASSERT_EQ(spare, h->mem);
+        ASSERT_EQ(104 + 40 * 65536, cheap_used(h));
+
+        cheap_rewind(h, mark0);
+        ASSERT_EQ(spare, h->spare->mem);
+    }
+
+    cheap_destroy(h);
+}
+
+/* Reservations: commit, shrink, abort, and allocating past one */
+TEST(cheap_test, reserve)
+{
+    struct cheap_resv resv, resv2;
+    struct cheap *    h;
+    void *            p;
+    int               rc;
+
+    h = cheap_create(8, 1048576);
+    ASSERT_NE(0UL, (u_int64_t)h);
+
+    /* Failure is up front and leaves the cheap untouched */
+    rc = cheap_reserve(h, &resv, h->size + 1);
+    ASSERT_EQ(-ENOMEM, rc);
+    ASSERT_EQ(0UL, (u_int64_t)resv.addr);
+    ASSERT_EQ(0, cheap_used(h));
+
+    /* Abort at the top of the cheap gives the space back */
+    rc = cheap_reserve(h, &resv, 1000);
+    ASSERT_EQ(0, rc);
+    ASSERT_EQ(h->base, (u_int64_t)resv.addr);
+    ASSERT_EQ(1000, cheap_used(h));
+    cheap_abort(h, &resv);
+    ASSERT_EQ(0, cheap_used(h));
+    ASSERT_EQ(0UL, (u_int64_t)resv.addr);
+
+    /* Commit at the top gives back the unused tail */
+    rc = cheap_reserve(h, &resv, 1000);
+    ASSERT_EQ(0, rc);
+    p = cheap_commit(h, &resv, 200);
+    ASSERT_EQ(h->base, (u_int64_t)p);
+    ASSERT_EQ(200, cheap_used(h));
+
+    /* cheap_free() can't undo a reservation */
+    cheap_free(h, p);
+    ASSERT_EQ(200, cheap_used(h));
+
+    /* Other allocations go past an outstanding reservation */
+    rc = cheap_reserve(h, &resv, 1000);
+    ASSERT_EQ(0, rc);
+    p = cheap_malloc(h, 100);
+    ASSERT_EQ((u_int64_t)resv.addr + 1000, (u_int64_t)p);
+
+    rc = cheap_reserve(h, &resv2, 1000);
+    ASSERT_EQ(0, rc);
+    ASSERT_EQ((u_int64_t)p + 104, (u_int64_t)resv2.addr);
+
+    /* ... in which case commit and abort cannot give anything back */
+    p = cheap_commit(h, &resv, 10);
+    ASSERT_NE(0UL, (u_int64_t)p);
+    ASSERT_EQ(200 + 1000 + 104 + 1000, cheap_used(h));
+
+    cheap_abort(h, &resv2);
+    ASSERT_EQ(200 + 1000 + 104, cheap_used(h));
+
+    cheap_destroy(h);
+}
+
+TEST(cheap_test, reserve_mt)
+{
+    struct cheap_resv resv;
+    struct cheap *    h;
+    void *            p;
+    int               rc;
+
+    h = cheap_create_mt(8, 1048576);
+    ASSERT_NE(0UL, (u_int64_t)h);
+
+    rc = cheap_reserve(h, &resv, 1001);
+    ASSERT_EQ(0, rc);
+    ASSERT_EQ(1008, resv.size);
+
+    p = cheap_commit(h, &resv, 99);
+    ASSERT_EQ(h->base, (u_int64_t)p);
+    ASSERT_EQ(104, cheap_used(h));
+
+    rc = cheap_reserve(h, &resv, 1000);
+    ASSERT_EQ(0, rc);
+    memset(resv.addr, 0xff, 1000);
+    cheap_abort(h, &resv);
+    ASSERT_EQ(104, cheap_used(h));
+    ASSERT_GE(h->brk, h->base + 1104);
+
+    /* Reservations are carved from the thread's chunk */
+    rc = cheap_tcache_enable(h, 64 * 1024);
+    ASSERT_EQ(0, rc);
+
+    rc = cheap_reserve(h, &resv, 1000);
+    ASSERT_EQ(0, rc);
+    ASSERT_EQ(h->base + 128, (u_int64_t)resv.addr);
+    ASSERT_EQ(128 + 1000, cheap_used(h));
+    p = cheap_commit(h, &resv, 500);
+    ASSERT_EQ((u_int64_t)resv.addr, 0UL);
+    ASSERT_EQ((u_int64_t)p + 504, (u_int64_t)cheap_malloc(h, 8));
+
+    cheap_destroy(h);
+}
+
+/* A batch lands exactly where the same sequence of cheap_malloc()
+ * calls would have put it.
+ */
+TEST(cheap_test, malloc_batch)
+{
+    struct cheap *h1, *h2;
+    size_t        sizev[64];
+    void *        outv[64];
+    struct xrand  xr;
+    int           align, i, j, n, rc;
+
+    xrand_init(&xr, 42);
+
+    for (align = 1; align <= 64; align *= 2) {
+        h1 = cheap_create(align, 1048576);
+        ASSERT_NE(0UL, (u_int64_t)h1);
+        h2 = cheap_create(align, 1048576);
+        ASSERT_NE(0UL, (u_int64_t)h2);
+
+        for (j = 0; j < 10; ++j) {
+            n = xrand_range64(&xr, 1, 64);
+
+            for (i = 0; i < n; ++i)
+                sizev[i] = xrand_range64(&xr, 1, 300);
+
+            rc = cheap_malloc_batch(h1, sizev, n, outv);
+            ASSERT_EQ(0, rc);
+
+            for (i = 0; i < n; ++i) {
+                void *p = cheap_malloc(h2, sizev[i]);
+
+                ASSERT_EQ((u_int64_t)p - h2->base, (u_int64_t)outv[i] - h1->base);
+                memset(outv[i], i, sizev[i]);
+            }
+
+            ASSERT_EQ(cheap_used(h2), cheap_used(h1));
+        }
+
+        /* cheap_free() undoes the last item only */
+        cheap_free(h1, outv[0]);
+        ASSERT_EQ(cheap_used(h2), cheap_used(h1));
+        cheap_free(h1, outv[n - 1]);
+        ASSERT_EQ((u_int64_t)outv[n - 1] - h1->base, cheap_used(h1));
+
+        cheap_destroy(h1);
+        cheap_destroy(h2);
+    }
+}
+
+TEST(cheap_test, malloc_n)
+{
+    struct cheap *h;
+    void *        outv[100];
+    size_t        used;
+    int           i, rc;
+
+    h = cheap_create(8, 1048576);
+    ASSERT_NE(0UL, (u_int64_t)h);
+
+    rc = cheap_malloc_n(h, 13, 100, outv);
+    ASSERT_EQ(0, rc);
+    for (i = 0; i < 100; ++i)
+        ASSERT_EQ(h->base + i * 16, (u_int64_t)outv[i]);
+    ASSERT_EQ(99 * 16 + 13, cheap_used(h));
+
+    /* All or nothing */
+    used = cheap_used(h);
+    rc = cheap_malloc_n(h, h->size / 50, 100, outv);
+    ASSERT_EQ(-ENOMEM, rc);
+    ASSERT_EQ(used, cheap_used(h));
+
+    rc = cheap_malloc_n(h, SIZE_MAX / 2, 3, outv);
+    ASSERT_EQ(-ENOMEM, rc);
+    ASSERT_EQ(used, cheap_used(h));
+
+    cheap_destroy(h);
+
+    h = cheap_create_mt(8, 1048576);
+    ASSERT_NE(0UL, (u_int64_t)h);
+
+    rc = cheap_malloc_n(h, 13, 100, outv);
+    ASSERT_EQ(0, rc);
+    for (i = 0; i < 100; ++i)
+        ASSERT_EQ(h->base + i * 16, (u_int64_t)outv[i]);
+    ASSERT_EQ(100 * 16, cheap_used(h));
+
+    cheap_destroy(h);
+}
+
+TEST(cheap_test, huge_invalid_flags)
+{
+    struct cheap *h;
+
+    h = cheap_create_flags(8, 4ul << 20, CHEAP_F_HUGE_2M | CHEAP_F_HUGE_1G);
+    ASSERT_EQ(0UL, (u_int64_t)h);
+
+    h = cheap_create_flags(8, 4ul << 20, CHEAP_F_THP | CHEAP_F_HUGE_2M);
+    ASSERT_EQ(0UL, (u_int64_t)h);
+
+    h = cheap_create_flags(8, 4ul << 20, CHEAP_F_HUGE_MEMFD);
+    ASSERT_EQ(0UL, (u_int64_t)h);
+}
+
+/* The kernel may have no huge pages to give, in which case the cheap
+ * must fall back (and say so via its flags and page size).
+ */
+static void
+huge_check(u_int32_t flags)
+{
+    struct cheap *h;
+    size_t        sz = 8ul << 20;
+    size_t        pagesz;
+    u_int8_t *    p;
+
+    h = cheap_create_flags(8, sz, flags);
+    ASSERT_NE(0UL, (u_int64_t)h);
+
+    pagesz = cheap_pagesize(h);
+    if (h->flags & CHEAP_F_HUGE_1G) {
+        ASSERT_EQ(CHEAP_HUGE_1G_SZ, pagesz);
+    } else if (h->flags & CHEAP_F_HUGE_2M) {
+        ASSERT_EQ(CHEAP_HUGE_2M_SZ, pagesz);
+    } else if (!(h->flags & CHEAP_F_THP)) {
+        ASSERT_EQ((size_t)PAGE_SIZE, pagesz);
+    }
+
+    ASSERT_EQ(0UL, h->flags & ~flags & ~(CHEAP_F_HUGE_2M | CHEAP_F_PRIVATE));
+    ASSERT_EQ(0UL, (u_int64_t)h->mem % pagesz);
+    ASSERT_EQ(0UL, h->size % pagesz);
+    ASSERT_GE(h->size, sz);
+
+    p = (u_int8_t *)cheap_malloc(h, sz / 2);
+    ASSERT_NE(0UL, (u_int64_t)p);
+    memset(p, 0xa5, sz / 2);
+    ASSERT_EQ(0xa5, p[sz / 2 - 1]);
+
+    cheap_reset(h, 0);
+    cheap_trim(h, 0);
+    ASSERT_EQ(h->base, h->cursorp);
+
+    p = (u_int8_t *)cheap_malloc(h, sz / 2);
+    ASSERT_NE(0UL, (u_int64_t)p);
+    p[0] = 1;
+
+    cheap_destroy(h);
+}
+
+TEST(cheap_test, huge_2m)
+{
+    huge_check(CHEAP_F_HUGE_2M);
+    huge_check(CHEAP_F_HUGE_2M | CHEAP_F_HUGE_MEMFD);
+}
+
+TEST(cheap_test, huge_1g)
+{
+    huge_check(CHEAP_F_HUGE_1G);
+    huge_check(CHEAP_F_HUGE_1G | CHEAP_F_HUGE_MEMFD);
+}
+
+TEST(cheap_test, huge_thp)
+{
+    huge_check(CHEAP_F_THP);
+    huge_check(CHEAP_F_THP | CHEAP_F_MT);
+}
+
+TEST(cheap_test, huge_grow)
+{
+    struct cheap *h;
+    int           i;
+
+    h = cheap_create_flags(8, 2ul << 20, CHEAP_F_GROW | CHEAP_F_HUGE_2M);
+    ASSERT_NE(0UL, (u_int64_t)h);
+
+    for (i = 0; i < 64; ++i)
+        ASSERT_NE(0UL, (u_int64_t)cheap_malloc(h, 65536));
+
+    ASSERT_NE(0UL, (u_int64_t)h->seg->next);
+    ASSERT_EQ(h->pagesz, h->seg->pagesz);
+    ASSERT_EQ(64 * 65536UL, cheap_used(h));
+
+    cheap_destroy(h);
+}
+
+TEST(cheap_test, fork_invalid_flags)
+{
+    struct cheap *h;
+
+    /* WIPEONFORK needs a private, non-hugetlb mapping */
+    h = cheap_create_flags(8, 4ul << 20, CHEAP_F_WIPEONFORK);
+    ASSERT_EQ(0UL, (u_int64_t)h);
+
+    h = cheap_create_flags(8, 4ul << 20,
+                           CHEAP_F_PRIVATE | CHEAP_F_HUGE_2M | CHEAP_F_WIPEONFORK);
+    ASSERT_EQ(0UL, (u_int64_t)h);
+
+    h = cheap_create_flags(8, 4ul << 20,
+                           CHEAP_F_PRIVATE | CHEAP_F_DONTFORK | CHEAP_F_WIPEONFORK);
+    ASSERT_EQ(0UL, (u_int64_t)h);
+
+    h = cheap_create_flags(8, 4ul << 20, CHEAP_F_THP);
+    ASSERT_NE(0UL, (u_int64_t)h);
+    ASSERT_TRUE(h->flags & CHEAP_F_PRIVATE);
+    cheap_destroy(h);
+}
+
+/* Fork a child that writes 2 to *p after checking that it reads @expect,
+ * and return what the parent sees afterward.  If the child gets a signal
+ * instead, return minus the signal number.
+ */
+static int
+fork_check(volatile u_int8_t *p, int expect)
+{
+    pid_t pid;
+    int   status;
+
+    pid = fork();
+    if (pid == 0) {
+        if (*p != expect)
+            _exit(1);
+        *p = 2;
+        _exit(0);
+    }
+
+    if (pid < 0 || waitpid(pid, &status, 0) != pid)
+        return -1000;
+
+    if (WIFSIGNALED(status))
+        return -WTERMSIG(status);
+
+    if (WEXITSTATUS(status))
+        return -1001;
+
+    return *p;
+}
+
+TEST(cheap_test, fork_private)
+{
+    struct cheap *h;
+    u_int8_t *    p;
+
+    /* Shared: the parent sees the child's write */
+    h = cheap_create(8, 4ul << 20);
+    ASSERT_NE(0UL, (u_int64_t)h);
+    p = (u_int8_t *)cheap_malloc(h, 64);
+    *p = 1;
+    ASSERT_EQ(2, fork_check(p, 1));
+    cheap_destroy(h);
+
+    /* Private: the child gets a copy */
+    h = cheap_create_flags(8, 4ul << 20, CHEAP_F_PRIVATE);
+    ASSERT_NE(0UL, (u_int64_t)h);
+    p = (u_int8_t *)cheap_malloc(h, 64);
+    *p = 1;
+    ASSERT_EQ(1, fork_check(p, 1));
+
+    /* Trimmed pages of a private cheap read back as zero */
+    cheap_reset(h, 0);
+    cheap_trim(h, 0);
+    p = (u_int8_t *)cheap_malloc(h, 64);
+    ASSERT_EQ(0, *p);
+    cheap_destroy(h);
+
+    /* Wipe-on-fork: the child sees zeroes */
+    h = cheap_create_flags(8, 4ul << 20, CHEAP_F_PRIVATE | CHEAP_F_WIPEONFORK);
+    ASSERT_NE(0UL, (u_int64_t)h);
+    p = (u_int8_t *)cheap_malloc(h, 64);
+    *p = 1;
+    ASSERT_EQ(1, fork_check(p, 0));
+    cheap_destroy(h);
+
+    /* Don't-fork: the child has no cheap at all */
+    h = cheap_create_flags(8, 4ul << 20, CHEAP_F_PRIVATE | CHEAP_F_DONTFORK);
+    ASSERT_NE(0UL, (u_int64_t)h);
+    p = (u_int8_t *)cheap_malloc(h, 64);
+    *p = 1;
+    ASSERT_EQ(-SIGSEGV, fork_check(p, 1));
+    cheap_destroy(h);
+}
+
+TEST(cheap_test, fork_grow)
+{
+    struct cheap *h;
+    u_int8_t *    p;
+    int           i;
+
+    h = cheap_create_flags(8, 2ul << 20,
+                           CHEAP_F_GROW | CHEAP_F_PRIVATE | CHEAP_F_WIPEONFORK);
+    ASSERT_NE(0UL, (u_int64_t)h);
+
+    for (i = 0; i < 64; ++i)
+        ASSERT_NE(0UL, (u_int64_t)cheap_malloc(h, 65536));
+    ASSERT_NE(0UL, (u_int64_t)h->seg->next);
+
+    /* New segments get the same treatment as the first */
+    p = (u_int8_t *)cheap_malloc(h, 64);
+    *p = 1;
+    ASSERT_EQ(1, fork_check(p, 0));
+
+    cheap_destroy(h);
+}
+
+TEST(cheap_test, populate)
+{
+    struct cheap * h;
+    size_t         maxpg = (16ul << 20) / PAGE_SIZE;
+    unsigned char *vec = (unsigned char *)malloc(maxpg);
+    u_int8_t *     p;
+    int            nthreads;
+
+    for (nthreads = 0; nthreads <= 4; ++nthreads) {
+        h = cheap_create(8, 16ul << 20);
+        ASSERT_NE(0UL, (u_int64_t)h);
+        ASSERT_EQ(0UL, rss(h->mem, maxpg, vec));
+
+        /* Partial, rounded up to a page */
+        ASSERT_EQ(0, cheap_populate(h, 1ul << 20, nthreads));
+        ASSERT_EQ(1ul << 20, rss(h->mem, maxpg, vec));
+
+        p = (u_int8_t *)cheap_malloc(h, 1000);
+        memset(p, 0xa5, 1000);
+
+        /* All of it, without disturbing what's there */
+        ASSERT_EQ(0, cheap_populate(h, 0, nthreads));
+        ASSERT_EQ(16ul << 20, rss(h->mem, maxpg, vec));
+        ASSERT_EQ(0xa5, p[999]);
+        ASSERT_EQ(0, p[1000]);
+
+        /* Populated pages are released by trim */
+        cheap_reset(h, 0);
+        cheap_trim(h, 1ul << 20);
+        ASSERT_EQ(1ul << 20, rss(h->mem, maxpg, vec));
+
+        cheap_destroy(h);
+    }
+
+    free(vec);
+}
+
+TEST(cheap_test, populate_flag)
+{
+    struct cheap *    h;
+    struct cheap_seg *seg;
+    size_t            maxpg = (8ul << 20) / PAGE_SIZE;
+    unsigned char *   vec = (unsigned char *)malloc(maxpg);
+    int               i;
+
+    h = cheap_create_flags(8, 8ul << 20, CHEAP_F_POPULATE | CHEAP_F_PRIVATE);
+    ASSERT_NE(0UL, (u_int64_t)h);
+    ASSERT_EQ(8ul << 20, rss(h->mem, maxpg, vec));
+    cheap_destroy(h);
+
+    /* New segments are populated too */
+    h = cheap_create_flags(8, 2ul << 20, CHEAP_F_POPULATE | CHEAP_F_GROW);
+    ASSERT_NE(0UL, (u_int64_t)h);
+
+    for (i = 0; i < 64; ++i)
+        ASSERT_NE(0UL, (u_int64_t)cheap_malloc(h, 65536));
+    ASSERT_NE(0UL, (u_int64_t)h->seg->next);
+
+    for (seg = h->seg; seg; seg = seg->next) {
+        maxpg = seg->len / PAGE_SIZE;
+        vec = (unsigned char *)realloc(vec, maxpg);
+        ASSERT_EQ(seg->len, rss(seg->mem, maxpg, vec));
+    }
+
+    cheap_destroy(h);
+    free(vec);
+}
+
+/* Wait up to a few seconds for the prefault thread to get [mem, mem + len)
+ * resident, and return how much of the first maxpg pages is resident.
+ */
+static size_t
+prefault_wait(void *mem, size_t len, size_t maxpg, unsigned char *vec)
+{
+    size_t sz = 0;
+    int    i;
+
+    for (i = 0; i < 5000; ++i) {
+        sz = rss(mem, maxpg, vec);
+        if (sz >= len)
+            break;
+        usleep(1000);
+    }
+
+    return sz;
+}
+
+TEST(cheap_test, prefault)
+{
+    struct cheap * h;
+    size_t         window = 8ul << 20, chunk = 1ul << 20;
+    size_t         maxpg = (64ul << 20) / PAGE_SIZE;
+    unsigned char *vec = (unsigned char *)malloc(maxpg);
+    size_t         sz;
+
+    h = cheap_create(8, 64ul << 20);
+    ASSERT_NE(0UL, (u_int64_t)h);
+
+    ASSERT_EQ(0, cheap_prefault_start(h, window, chunk));
+    ASSERT_EQ(-EBUSY, cheap_prefault_start(h, window, chunk));
+
+    /* The window beyond the cursor, and (much) no more */
+    sz = prefault_wait(h->mem, window, maxpg, vec);
+    ASSERT_GE(sz, window);
+    usleep(20 * 1000);
+    ASSERT_LE(rss(h->mem, maxpg, vec), window + chunk);
+
+    /* It follows the cursor */
+    ASSERT_NE(0UL, (u_int64_t)cheap_malloc(h, 16ul << 20));
+    sz = prefault_wait(h->mem, (16ul << 20) + window, maxpg, vec);
+    ASSERT_GE(sz, (16ul << 20) + window);
+
+    /* Trimmed pages within the window are populated again */
+    cheap_reset(h, 0);
+    cheap_trim(h, 0);
+    sz = prefault_wait(h->mem, window, maxpg, vec);
+    ASSERT_GE(sz, window);
+    ASSERT_LE(sz, window + 2 * chunk);
+
+    cheap_prefault_stop(h);
+    cheap_prefault_stop(h);
+
+    /* Destroy stops it, too */
+    ASSERT_EQ(0, cheap_prefault_start(h, 0, 0));
+    cheap_destroy(h);
+
+    free(vec);
+}
+
+TEST(cheap_test, prefault_grow)
+{
+    struct cheap * h;
+    size_t         window = 2ul << 20;
+    size_t         maxpg;
+    unsigned char *vec;
+    int            i;
+
+    h = cheap_create_flags(8, 4ul << 20, CHEAP_F_GROW | CHEAP_F_MT);
+    ASSERT_NE(0UL, (u_int64_t)h);
+    ASSERT_EQ(0, cheap_prefault_start(h, window, 0));
+
+    for (i = 0; i < 100; ++i)
+        ASSERT_NE(0UL, (u_int64_t)cheap_malloc(h, 65536));
+    ASSERT_NE(0UL, (u_int64_t)h->seg->next);
+
+    /* Ahead of the cursor in the new segment */
+    maxpg = h->seg->len / PAGE_SIZE;
+    vec = (unsigned char *)malloc(maxpg);
+    ASSERT_GE(prefault_wait(h->seg->mem, (h->cursorp - h->base) + window, maxpg, vec),
+              window);
+
+    cheap_destroy(h);
+    free(vec);
+}
+
+TEST(cheap_test, zero)
+{
+    size_t    sizev[] = { 0, 1, 63, 64, 65, 4095, CHEAP_ZERO_NT_MIN - 1,
+                          CHEAP_ZERO_NT_MIN, CHEAP_ZERO_NT_MIN + 77 };
+    size_t    bufsz = CHEAP_ZERO_NT_MIN + 256;
+    u_int8_t *buf = (u_int8_t *)malloc(bufsz);
+    u_int8_t *ref = (u_int8_t *)malloc(bufsz);
+    size_t    i, off;
+
+    ASSERT_NE(0UL, (u_int64_t)cheap_zero_isa());
+
+    for (i = 0; i < sizeof(sizev) / sizeof(sizev[0]); ++i) {
+        for (off = 0; off < 128; off += 13) {
+            memset(buf, 0xff, bufsz);
+            memset(ref, 0xff, bufsz);
+            memset(ref + off, 0, sizev[i]);
+
+            cheap_zero(buf + off, sizev[i]);
+
+            ASSERT_EQ(0, memcmp(buf, ref, bufsz)) << "size " << sizev[i] << " off " << off;
+        }
+    }
+
+    free(ref);
+    free(buf);
+}
+
+TEST(cheap_test, calloc_large)
+{
+    struct cheap *h;
+    u_int8_t *    p;
+    size_t        sz = 2 * CHEAP_ZERO_NT_MIN + 8;
+    size_t        i;
+
+    h = cheap_create(8, 4 * CHEAP_ZERO_NT_MIN);
+    ASSERT_NE(0UL, (u_int64_t)h);
+
+    /* Dirty the memory, then give it back */
+    p = (u_int8_t *)cheap_malloc(h, sz);
+    memset(p, 0xa5, sz);
+    cheap_reset(h, 0);
+
+    p = (u_int8_t *)cheap_calloc(h, sz);
+    ASSERT_NE(0UL, (u_int64_t)p);
+    for (i = 0; i < sz; ++i)
+        ASSERT_EQ(0, p[i]);
+
+    cheap_reset(h, 0);
+    p = (u_int8_t *)cheap_malloc(h, sz);
+    memset(p, 0xa5, sz);
+    cheap_reset(h, 0);
+
+    p = (u_int8_t *)cheap_memalign_zero(h, 4096, sz);
+    ASSERT_NE(0UL, (u_int64_t)p);
+    ASSERT_EQ(0UL, (u_int64_t)p & 4095);
+    for (i = 0; i < sz; ++i)
+        ASSERT_EQ(0, p[i]);
+
+    /* A failed allocation must not be zeroed */
+    ASSERT_EQ(0UL, (u_int64_t)cheap_memalign_zero(h, 64, 8 * CHEAP_ZERO_NT_MIN));
+    ASSERT_EQ(0UL, (u_int64_t)cheap_calloc(h, 8 * CHEAP_ZERO_NT_MIN));
+
+    cheap_destroy(h);
+}
+
+static int
+all_zero(const void *p, size_t len)
+{
+    const u_int8_t *cp = (const u_int8_t *)p;
+    size_t          i;
+
+    for (i = 0; i < len; ++i)
+        if (cp[i])
+            return 0;
+
+    return 1;
+}
+
+TEST(cheap_test, calloc_known_zero)
+{
+    struct cheap * h;
+    size_t         maxpg = (8ul << 20) / PAGE_SIZE;
+    unsigned char *vec = (unsigned char *)malloc(maxpg);
+    u_int8_t *     p, *q;
+    size_t         sz = 1ul << 20;
+
+    h = cheap_create(8, 8ul << 20);
+    ASSERT_NE(0UL, (u_int64_t)h);
+
+    /* Fresh memory isn't written, so isn't faulted in */
+    p = (u_int8_t *)cheap_calloc(h, sz);
+    ASSERT_NE(0UL, (u_int64_t)p);
+    ASSERT_EQ(0UL, rss(h->mem, maxpg, vec));
+    p = (u_int8_t *)cheap_memalign_zero(h, 4096, sz);
+    ASSERT_EQ(0UL, rss(h->mem, maxpg, vec));
+
+    /* Dirty memory is zeroed after a reset ... */
+    cheap_reset(h, 0);
+    p = (u_int8_t *)cheap_malloc(h, 2 * sz);
+    memset(p, 0xff, 2 * sz);
+    cheap_reset(h, 0);
+
+    q = (u_int8_t *)cheap_calloc(h, 3 * sz);
+    ASSERT_EQ(p, q);
+    ASSERT_EQ(2 * sz, rss(h->mem, maxpg, vec));
+    ASSERT_TRUE(all_zero(q, 3 * sz));
+
+    /* ... but not after a trim */
+    cheap_reset(h, 0);
+    cheap_trim(h, 0);
+    ASSERT_EQ(0UL, rss(h->mem, maxpg, vec));
+    q = (u_int8_t *)cheap_calloc(h, 3 * sz);
+    ASSERT_TRUE(all_zero(q, 3 * sz));
+
+    /* Populating doesn't make memory dirty */
+    cheap_reset(h, 0);
+    cheap_trim(h, 0);
+    ASSERT_EQ(0, cheap_populate(h, 0, 1));
+    ASSERT_EQ(h->base, h->zbrk);
+    q = (u_int8_t *)cheap_malloc(h, sz);
+    memset(q, 0xff, sz);
+    p = (u_int8_t *)cheap_calloc(h, sz);
+    ASSERT_TRUE(all_zero(p, sz));
+
+    cheap_destroy(h);
+    free(vec);
+}
+
+TEST(cheap_test, calloc_giveback)
+{
+    struct cheap_resv resv;
+    struct cheap *    h;
+    u_int8_t *        p, *q;
+    u_int64_t         mark;
+    u_int32_t         flagsv[] = { 0, CHEAP_F_MT, CHEAP_F_GROW };
+    size_t            i;
+
+    for (i = 0; i < sizeof(flagsv) / sizeof(flagsv[0]); ++i) {
+        h = cheap_create_flags(8, 4ul << 20, flagsv[i]);
+        ASSERT_NE(0UL, (u_int64_t)h);
+
+        /* cheap_free() (a no-op for MT cheaps) */
+        p = (u_int8_t *)cheap_malloc(h, 1000);
+        memset(p, 0xff, 1000);
+        cheap_free(h, p);
+        q = (u_int8_t *)cheap_calloc(h, 1000);
+        ASSERT_TRUE(all_zero(q, 1000));
+
+        /* cheap_abort() */
+        ASSERT_EQ(0, cheap_reserve(h, &resv, 5000));
+        memset(resv.addr, 0xff, 5000);
+        p = (u_int8_t *)resv.addr;
+        cheap_abort(h, &resv);
+        q = (u_int8_t *)cheap_calloc(h, 5000);
+        ASSERT_EQ(p, q);
+        ASSERT_TRUE(all_zero(q, 5000));
+
+        /* cheap_rewind() */
+        mark = cheap_mark(h);
+        p = (u_int8_t *)cheap_malloc(h, 3000);
+        memset(p, 0xff, 3000);
+        cheap_rewind(h, mark);
+        q = (u_int8_t *)cheap_calloc(h, 3000);
+        ASSERT_EQ(p, q);
+        ASSERT_TRUE(all_zero(q, 3000));
+
+        cheap_destroy(h);
+    }
+}
+
+TEST(cheap_test, calloc_grow)
+{
+    struct cheap *h;
+    u_int8_t *    p;
+    u_int64_t     mark;
+    int           i;
+
+    h = cheap_create_flags(8, 2ul << 20, CHEAP_F_GROW);
+    ASSERT_NE(0UL, (u_int64_t)h);
+
+    /* Dirty two segments, then rewind so the second becomes the spare */
+    mark = cheap_mark(h);
+    for (i = 0; i < 48; ++i) {
+        p = (u_int8_t *)cheap_malloc(h, 65536);
+        memset(p, 0xff, 65536);
+    }
+    ASSERT_NE(0UL, (u_int64_t)h->seg->next);
+    cheap_rewind(h, mark);
+    ASSERT_NE(0UL, (u_int64_t)h->spare);
+
+    /* Calloc into the first segment, and into the reused spare */
+    for (i = 0; i < 48; ++i) {
+        p = (u_int8_t *)cheap_calloc(h, 65536);
+        ASSERT_NE(0UL, (u_int64_t)p);
+        ASSERT_TRUE(all_zero(p, 65536)) << i;
+    }
+    ASSERT_EQ(0UL, (u_int64_t)h->spare);
 
     cheap_destroy(h);
 }
-#endif
 
 //MTF_END_UTEST_COLLECTION(cheap_test)